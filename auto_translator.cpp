@@ -0,0 +1,3031 @@
+#include "auto_translator.h"
+
+#include <charconv>
+
+#ifdef QT_AUTO_TRANSLATION_ALLOC_COUNTERS
+#include <cstdlib>
+#include <new>
+
+// Plain integers, so malloc() can count before anything of the thread is initialized.
+static thread_local quint64 allocationCount = 0;
+static thread_local quint64 allocatedBytes = 0;
+
+static void countAllocation(std::size_t size)
+{
+    ++allocationCount;
+    allocatedBytes += size;
+}
+
+#ifdef __GLIBC__
+// Qt's containers allocate with malloc(), so that is what is counted. The replacements
+// forward to glibc's own functions, and memory is still released by its free().
+extern "C" {
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t count, std::size_t size);
+void *__libc_realloc(void *ptr, std::size_t size);
+
+void *malloc(std::size_t size) noexcept
+{
+    countAllocation(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(std::size_t count, std::size_t size) noexcept
+{
+    countAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, std::size_t size) noexcept
+{
+    countAllocation(size);
+    return __libc_realloc(ptr, size);
+}
+}
+#else
+// Without glibc only operator new is replaced, which misses what Qt allocates with malloc().
+void *operator new(std::size_t size)
+{
+    countAllocation(size);
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+#endif
+
+AllocationCount threadAllocations()
+{
+    return {allocationCount, allocatedBytes};
+}
+#else
+AllocationCount threadAllocations()
+{
+    return {};
+}
+#endif
+
+StringTable &locationFileNames()
+{
+    static StringTable table;
+    return table;
+}
+
+quint32 StringTable::intern(QStringView text)
+{
+    const size_t hash = qHash(text);
+    {
+        QReadLocker locker(&m_lock);
+        const quint32 id = find(text, hash);
+        if (id != kNotFound)
+            return id;
+    }
+    QWriteLocker locker(&m_lock);
+    const quint32 id = find(text, hash);
+    if (id != kNotFound)
+        return id;
+    m_strings.append(text.toString());
+    m_ids.insert(hash, quint32(m_strings.size() - 1));
+    return quint32(m_strings.size() - 1);
+}
+
+quint32 StringTable::find(QStringView text, size_t hash) const
+{
+    for (auto it = m_ids.constFind(hash); it != m_ids.constEnd() && it.key() == hash; ++it) {
+        if (m_strings.at(it.value()) == text)
+            return it.value();
+    }
+    return kNotFound;
+}
+
+FileStamp FileStamp::of(const QString &path)
+{
+    const QFileInfo info(path);
+    if (!info.exists())
+        return {};
+    return {info.size(), info.lastModified().toMSecsSinceEpoch()};
+}
+
+Metrics &metrics()
+{
+    static Metrics instance;
+    return instance;
+}
+
+void Metrics::addStage(const QString &name, qint64 nsecs, const AllocationCount &allocations)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_stages.find(name);
+    if (it == m_stages.end()) {
+        m_stageOrder.append(name);
+        it = m_stages.insert(name, {});
+    }
+    ++it->count;
+    it->totalNs += nsecs;
+    it->maxNs = qMax(it->maxNs, nsecs);
+    it->allocations += allocations.count;
+    it->allocatedBytes += allocations.bytes;
+}
+
+void Metrics::addUsage(const QJsonObject &usage)
+{
+    QMutexLocker locker(&m_mutex);
+    m_promptTokens += qint64(usage["prompt_tokens"].toDouble());
+    m_cachedPromptTokens += qint64(usage["prompt_tokens_details"].toObject()["cached_tokens"].toDouble());
+    m_completionTokens += qint64(usage["completion_tokens"].toDouble());
+}
+
+void Metrics::addAdaptiveDecision(const QString &backend, int batchSize, int concurrency, const QString &reason,
+                                  qint64 latencyMs, double tokensPerSecond, double missingFraction)
+{
+    QMutexLocker locker(&m_mutex);
+    QJsonObject decision;
+    decision["at_ms"] = m_clock.elapsed();
+    decision["backend"] = backend;
+    decision["batch_size"] = batchSize;
+    decision["concurrency"] = concurrency;
+    decision["reason"] = reason;
+    decision["latency_ms"] = latencyMs;
+    decision["tokens_per_second"] = tokensPerSecond;
+    decision["missing_fraction"] = missingFraction;
+    m_adaptiveDecisions.append(decision);
+}
+
+QJsonObject Metrics::toJson() const
+{
+    QMutexLocker locker(&m_mutex);
+    const qint64 wallMs = m_clock.elapsed();
+
+    QJsonObject stages;
+    for (const QString &name : m_stageOrder) {
+        const Stage &stage = m_stages[name];
+        QJsonObject entry;
+        entry["count"] = stage.count;
+        entry["total_ms"] = stage.totalNs / 1e6;
+        entry["max_ms"] = stage.maxNs / 1e6;
+        if (kAllocationCounters) {
+            entry["allocations"] = double(stage.allocations);
+            entry["allocated_bytes"] = double(stage.allocatedBytes);
+            entry["allocations_per_run"] = double(stage.allocations) / stage.count;
+        }
+        stages[name] = entry;
+    }
+
+    QList<qint64> queueWaits, ttfbs, totals;
+    QJsonObject byBackend;
+    int failed = 0;
+    for (const Request &request : m_requests) {
+        queueWaits.append(request.queueWaitMs);
+        if (request.ttfbMs >= 0)
+            ttfbs.append(request.ttfbMs);
+        totals.append(request.totalMs);
+        failed += request.failed ? 1 : 0;
+        QJsonObject backend = byBackend[request.backend].toObject();
+        backend["count"] = backend["count"].toInt() + 1;
+        backend["failed"] = backend["failed"].toInt() + (request.failed ? 1 : 0);
+        backend["phrases"] = backend["phrases"].toInt() + request.phrases;
+        backend["total_ms"] = backend["total_ms"].toDouble() + double(request.totalMs);
+        byBackend[request.backend] = backend;
+    }
+    QJsonObject requests;
+    requests["count"] = int(m_requests.size());
+    requests["failed"] = failed;
+    requests["retries"] = m_retries;
+    requests["fallbacks"] = m_fallbacks;
+    requests["dropped_phrases"] = m_droppedPhrases;
+    requests["queue_wait_ms"] = distribution(queueWaits);
+    requests["ttfb_ms"] = distribution(ttfbs);
+    requests["total_ms"] = distribution(totals);
+    requests["by_backend"] = byBackend;
+
+    QJsonObject tokens;
+    tokens["estimated_sent"] = m_estimatedTokens;
+    tokens["prompt"] = m_promptTokens;
+    tokens["cached_prompt"] = m_cachedPromptTokens;
+    tokens["completion"] = m_completionTokens;
+
+    QJsonObject cache;
+    cache["hits"] = m_cacheHits;
+    cache["misses"] = m_cacheMisses;
+    cache["hit_rate"] = m_cacheHits + m_cacheMisses > 0 ? double(m_cacheHits) / (m_cacheHits + m_cacheMisses) : 0.0;
+
+    const auto network = m_stages.constFind(QStringLiteral("network"));
+    const double networkSeconds = network == m_stages.constEnd() ? 0.0 : network->totalNs / 1e9;
+    QJsonObject throughput;
+    throughput["phrases_applied"] = m_appliedPhrases;
+    throughput["messages_translated"] = m_messagesTranslated;
+    throughput["messages_per_second"] = wallMs > 0 ? m_messagesTranslated * 1000.0 / wallMs : 0.0;
+    throughput["phrases_per_network_second"] = networkSeconds > 0 ? m_appliedPhrases / networkSeconds : 0.0;
+
+    QJsonObject report;
+    report["wall_time_ms"] = wallMs;
+    report["stages"] = stages;
+    report["requests"] = requests;
+    report["tokens"] = tokens;
+    report["cache"] = cache;
+    report["throughput"] = throughput;
+    if (!m_adaptiveDecisions.isEmpty())
+        report["adaptive_batching"] = m_adaptiveDecisions;
+    return report;
+}
+
+bool Metrics::writeReport(const QString &path) const
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write metrics report:" << path;
+        return false;
+    }
+    file.write(QJsonDocument(toJson()).toJson(QJsonDocument::Indented));
+    return file.commit();
+}
+
+QJsonObject Metrics::distribution(QList<qint64> values)
+{
+    QJsonObject result;
+    if (values.isEmpty())
+        return result;
+    std::sort(values.begin(), values.end());
+    qint64 sum = 0;
+    for (qint64 value : values)
+        sum += value;
+    result["avg"] = double(sum) / values.size();
+    result["p50"] = values.at(values.size() / 2);
+    result["p95"] = values.at(qMin(values.size() - 1, values.size() * 95 / 100));
+    result["max"] = values.last();
+    return result;
+}
+
+int Catalog::addMessage(MessageInfo msg, const QList<Location> &locations)
+{
+    msg.context = int(m_contexts.size()) - 1;
+    msg.firstLocation = int(m_locations.size());
+    msg.locationCount = int(locations.size());
+    m_locations.append(locations);
+    m_messages.append(std::move(msg));
+    ++m_contexts.last().messageCount;
+    return int(m_messages.size()) - 1;
+}
+
+void Catalog::setLocations(int id, const QList<Location> &locations)
+{
+    MessageInfo &msg = m_messages[id];
+    if (msg.locationCount == locations.size()) {
+        const auto sameLocation = [](const Location &a, const Location &b) {
+            return a.fileId == b.fileId && a.line == b.line;
+        };
+        if (std::equal(locations.cbegin(), locations.cend(), m_locations.cbegin() + msg.firstLocation, sameLocation))
+            return;
+        msg.locationsModified = true;
+        std::copy(locations.cbegin(), locations.cend(), m_locations.begin() + msg.firstLocation);
+        return;
+    }
+    msg.locationsModified = true;
+    m_unusedLocations += msg.locationCount;
+    msg.firstLocation = int(m_locations.size());
+    msg.locationCount = int(locations.size());
+    m_locations.append(locations);
+    if (m_unusedLocations > m_locations.size() / 2)
+        compactLocations();
+}
+
+void Catalog::append(const Catalog &other, int ordinalOffset)
+{
+    const int contextOffset = int(m_contexts.size());
+    const int messageOffset = int(m_messages.size());
+    const int locationOffset = int(m_locations.size());
+    m_contexts.reserve(m_contexts.size() + other.m_contexts.size());
+    for (ContextInfo context : other.m_contexts) {
+        context.firstMessage += messageOffset;
+        m_contexts.append(context);
+    }
+    m_messages.reserve(m_messages.size() + other.m_messages.size());
+    for (MessageInfo msg : other.m_messages) {
+        msg.context += contextOffset;
+        msg.firstLocation += locationOffset;
+        msg.ordinal += ordinalOffset;
+        m_messages.append(std::move(msg));
+    }
+    m_locations.append(other.m_locations);
+    m_unusedLocations += other.m_unusedLocations;
+}
+
+void Catalog::buildSourceIndex()
+{
+    m_sourceIndex.clear();
+    for (int id = 0; id < m_messages.size(); ++id) {
+        const QString &source = m_messages.at(id).source;
+        if (!source.isEmpty())
+            m_sourceIndex[source].append(id);
+    }
+}
+
+void Catalog::compactLocations()
+{
+    QList<Location> locations;
+    locations.reserve(m_locations.size() - m_unusedLocations);
+    for (MessageInfo &msg : m_messages) {
+        const int first = int(locations.size());
+        locations.append(m_locations.constData() + msg.firstLocation, msg.locationCount);
+        msg.firstLocation = first;
+    }
+    m_locations = std::move(locations);
+    m_unusedLocations = 0;
+}
+
+/// @brief Reads the <context> elements of a TS document.
+/// @details Location filenames are interned in locationFileNames(). Contexts are kept in
+/// document order, including contexts that share a name.
+///
+/// @param xml The reader positioned anywhere before the first context.
+/// @param messagesRead Receives the number of messages read, including those of unnamed contexts.
+/// @return The catalog of the document's messages.
+Catalog readTsContexts(QXmlStreamReader &xml, int *messagesRead = nullptr)
+{
+    Catalog catalog;
+    QString contextName;
+    int ordinal = 0;
+    QList<QPair<MessageInfo, QList<Location>>> messages;
+
+    while (!xml.atEnd() && !xml.hasError()) {
+        QXmlStreamReader::TokenType token = xml.readNext();
+        if (token == QXmlStreamReader::StartElement) {
+            if (xml.name() == QLatin1String("context")) {
+                contextName.clear();
+                messages.clear();
+                while (!(xml.tokenType() == QXmlStreamReader::EndElement && xml.name() == QLatin1String("context"))) {
+                    if (xml.tokenType() == QXmlStreamReader::StartElement) {
+                        if (xml.name() == QLatin1String("name")) {
+                            contextName = xml.readElementText();
+                        } else if (xml.name() == QLatin1String("message")) {
+                            MessageInfo msg;
+                            QList<Location> locations;
+                            msg.ordinal = ordinal++;
+                            while (!(xml.tokenType() == QXmlStreamReader::EndElement && xml.name() == QLatin1String("message"))) {
+                                if (xml.tokenType() == QXmlStreamReader::StartElement) {
+                                    if (xml.name() == QLatin1String("location")) {
+                                        QXmlStreamAttributes attrs = xml.attributes();
+                                        Location loc;
+                                        loc.fileId = locationFileNames().intern(attrs.value("filename"));
+                                        loc.line = attrs.value("line").toInt();
+                                        locations.append(loc);
+                                        xml.skipCurrentElement();
+                                    } else if (xml.name() == QLatin1String("source")) {
+                                        msg.source = xml.readElementText();
+                                    } else if (xml.name() == QLatin1String("translation")) {
+                                        QXmlStreamAttributes attrs = xml.attributes();
+                                        msg.translationType = attrs.value("type").toString();
+                                        msg.translation = xml.readElementText();
+                                        msg.originalTranslation = msg.translation;
+                                        msg.originalType = msg.translationType;
+                                    }
+                                }
+                                xml.readNext();
+                            }
+                            messages.append({msg, locations});
+                        }
+                    }
+                    xml.readNext();
+                }
+                if (!contextName.isEmpty()) {
+                    catalog.addContext(contextName);
+                    for (const auto &message : std::as_const(messages))
+                        catalog.addMessage(message.first, message.second);
+                }
+            }
+        }
+    }
+    if (xml.hasError())
+        qWarning() << "XML Parsing Error:" << xml.errorString();
+    if (messagesRead)
+        *messagesRead = ordinal;
+    return catalog;
+}
+
+/// TS size in bytes from which parseTsFile() splits the file in Parallel mode.
+const qsizetype kParallelTsBytes = 4 * 1024 * 1024;
+
+/// @brief Splits the contexts of a TS document into chunks of about equal size.
+/// @details Chunks start at a <context> tag and the last one ends after the last </context>,
+/// so each is a sequence of whole context elements. Text can not contain a literal "<context"
+/// as TS files escape '<'; one inside a comment makes its chunk fail to parse.
+///
+/// @return The [start, end) byte ranges of the chunks, or none if the document has no contexts.
+static QList<QPair<qsizetype, qsizetype>> splitTsContexts(QByteArrayView data, int chunkCount)
+{
+    QList<QPair<qsizetype, qsizetype>> chunks;
+    const QByteArrayView openTag("<context");
+    const qsizetype last = data.lastIndexOf(QByteArrayView("</context>"));
+    if (last < 0)
+        return chunks;
+    const qsizetype end = last + qsizetype(sizeof("</context>") - 1);
+    const qsizetype target = end / qMax(1, chunkCount) + 1;
+
+    qsizetype from = data.indexOf(openTag);
+    while (from >= 0 && from < end) {
+        // The next chunk starts at the first context tag past the target size.
+        qsizetype next = from + target < end ? data.indexOf(openTag, from + target) : -1;
+        while (next >= 0 && next + openTag.size() < data.size() && data.at(next + openTag.size()) != '>'
+               && data.at(next + openTag.size()) != ' ')
+            next = data.indexOf(openTag, next + 1);
+        if (next < 0 || next >= end) {
+            chunks.append({from, end});
+            break;
+        }
+        chunks.append({from, next});
+        from = next;
+    }
+    return chunks;
+}
+
+/// @brief Parses a TS document on all cores, see TsReadMode::Parallel.
+static Catalog readTsContextsParallel(const QByteArray &data)
+{
+    const QList<QPair<qsizetype, qsizetype>> chunks = splitTsContexts(data, QThread::idealThreadCount() * 4);
+    if (chunks.size() < 2) {
+        QXmlStreamReader xml(data);
+        return readTsContexts(xml);
+    }
+
+    struct ChunkResult {
+        Catalog catalog;
+        int messagesRead = 0;
+        bool ok = false;
+    };
+    const QList<ChunkResult> results = QtConcurrent::blockingMapped<QList<ChunkResult>>(
+        chunks, [&data](const QPair<qsizetype, qsizetype> &chunk) {
+            // Each chunk is wrapped in a root element of its own to be a well-formed document.
+            QXmlStreamReader xml;
+            xml.addData(QByteArrayLiteral("<TS>"));
+            xml.addData(QByteArray::fromRawData(data.constData() + chunk.first, chunk.second - chunk.first));
+            xml.addData(QByteArrayLiteral("</TS>"));
+            ChunkResult result;
+            result.catalog = readTsContexts(xml, &result.messagesRead);
+            result.ok = !xml.hasError();
+            return result;
+        });
+
+    Catalog catalog;
+    int ordinalOffset = 0;
+    for (const ChunkResult &result : results) {
+        if (!result.ok) {
+            qWarning() << "Parsing the TS file sequentially, as a chunk of it could not be parsed on its own.";
+            QXmlStreamReader xml(data);
+            return readTsContexts(xml);
+        }
+        catalog.append(result.catalog, ordinalOffset);
+        ordinalOffset += result.messagesRead;
+    }
+    return catalog;
+}
+
+Catalog parseTsFile(const QString &filePath, TsReadMode mode)
+{
+    // Stamped before reading, so a change made meanwhile shows as a changed file later.
+    const FileStamp stamp = FileStamp::of(filePath);
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Unable to open file:" << filePath;
+        return {};
+    }
+    Catalog catalog;
+    const bool map = mode == TsReadMode::Mapped || mode == TsReadMode::Parallel;
+    const uchar *mapped = (map && file.size() > 0) ? file.map(0, file.size()) : nullptr;
+    if (mode == TsReadMode::Parallel && file.size() >= kParallelTsBytes) {
+        const QByteArray data = mapped ? QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), file.size())
+                                       : file.readAll();
+        catalog = readTsContextsParallel(data);
+    } else if (mapped) {
+        // The reader works on the mapping itself; fromRawData() does not copy it.
+        QXmlStreamReader xml(QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), file.size()));
+        catalog = readTsContexts(xml);
+    } else {
+        QXmlStreamReader xml(&file);
+        catalog = readTsContexts(xml);
+    }
+    catalog.setSourceStamp(stamp);
+    return catalog;
+}
+
+bool writeTsFile(const QString &filePath, const Catalog &catalog)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Unable to open file for writing:" << filePath;
+        return false;
+    }
+    QXmlStreamWriter writer(&file);
+    writer.setAutoFormatting(true);
+    writer.writeStartDocument();
+    writer.writeDTD("<!DOCTYPE TS>");
+    writer.writeStartElement("TS");
+    writer.writeAttribute("version", "2.1");
+    writer.writeAttribute("language", "en_US"); // Adjust if needed.
+
+    // Iterate over contexts.
+    for (const ContextInfo &context : catalog.contexts()) {
+        writer.writeStartElement("context");
+        writer.writeTextElement("name", context.name);
+        // Iterate over messages.
+        for (int id = context.firstMessage; id < context.firstMessage + context.messageCount; ++id) {
+            const MessageInfo &msg = catalog.message(id);
+            writer.writeStartElement("message");
+            // Write each location.
+            for (const Location &loc : catalog.locations(msg)) {
+                writer.writeEmptyElement("location");
+                writer.writeAttribute("filename", loc.filename());
+                writer.writeAttribute("line", QString::number(loc.line));
+            }
+            writer.writeTextElement("source", msg.source);
+            writer.writeStartElement("translation");
+            // Set type attribute if translation is still empty.
+            if (msg.translation.isEmpty())
+                writer.writeAttribute("type", "unfinished");
+            writer.writeCharacters(msg.translation);
+            writer.writeEndElement(); // </translation>
+            writer.writeEndElement(); // </message>
+        }
+        writer.writeEndElement(); // </context>
+    }
+    writer.writeEndElement(); // </TS>
+    writer.writeEndDocument();
+    file.close();
+    return true;
+}
+
+/// @brief Byte range of one element in a TS file.
+struct ByteSpan {
+    qint64 begin; ///< Offset of the element's '<'.
+    qint64 end;   ///< Offset just past the element's closing '>'.
+};
+
+/// @brief The <source> and <translation> elements of one message in a TS file.
+struct MessageSpans {
+    ByteSpan source{-1, -1};
+    ByteSpan translation{-1, -1};
+};
+
+/// @brief Locates the <source> and <translation> elements of every message in a TS file.
+/// @details A byte level scan that relies on '<' only starting markup outside comments, CDATA
+/// sections and processing instructions, which holds for any well-formed TS file. Messages
+/// are reported in document order, matching MessageInfo::ordinal.
+///
+/// @param data The TS file contents.
+/// @param size The number of bytes.
+/// @return One entry per message; a span's begin is -1 if the message has no such element.
+QList<MessageSpans> scanMessageSpans(const char *data, qint64 size)
+{
+    const QByteArray bytes = QByteArray::fromRawData(data, size);
+    auto matchesAt = [&](qint64 pos, const char *text) {
+        const qint64 length = qint64(strlen(text));
+        return pos + length <= size && memcmp(data + pos, text, length) == 0;
+    };
+    auto startsWithTag = [&](qint64 pos, const char *tag) {
+        if (!matchesAt(pos, tag))
+            return false;
+        const qint64 next = pos + qint64(strlen(tag));
+        return next < size && (data[next] == '>' || data[next] == '/' || data[next] == ' '
+                               || data[next] == '\t' || data[next] == '\r' || data[next] == '\n');
+    };
+    // Finds the '>' closing the tag at pos, skipping quoted attribute values.
+    auto tagEnd = [&](qint64 pos) -> qint64 {
+        char quote = 0;
+        for (; pos < size; ++pos) {
+            if (quote) {
+                if (data[pos] == quote)
+                    quote = 0;
+            } else if (data[pos] == '"' || data[pos] == '\'') {
+                quote = data[pos];
+            } else if (data[pos] == '>') {
+                return pos;
+            }
+        }
+        return -1;
+    };
+
+    // Finds the end of the element whose start tag is at pos, or -1 if it is not closed.
+    auto elementEnd = [&](qint64 pos, const char *closeTag) -> qint64 {
+        const qint64 gt = tagEnd(pos);
+        if (gt == -1)
+            return -1;
+        if (data[gt - 1] == '/')
+            return gt + 1;
+        const qint64 close = bytes.indexOf(closeTag, gt);
+        return close == -1 ? -1 : close + qint64(strlen(closeTag));
+    };
+
+    QList<MessageSpans> spans;
+    bool inMessage = false;
+    qint64 pos = 0;
+    while ((pos = bytes.indexOf('<', pos)) != -1) {
+        const char *terminator = matchesAt(pos, "<!--")        ? "-->"
+                                 : matchesAt(pos, "<![CDATA[") ? "]]>"
+                                 : matchesAt(pos, "<?")        ? "?>"
+                                                               : nullptr;
+        if (terminator) {
+            const qint64 close = bytes.indexOf(terminator, pos);
+            if (close == -1)
+                break;
+            pos = close + qint64(strlen(terminator));
+        } else if (startsWithTag(pos, "<message")) {
+            spans.append({});
+            inMessage = true;
+            ++pos;
+        } else if (inMessage && startsWithTag(pos, "<source")) {
+            const qint64 end = elementEnd(pos, "</source>");
+            if (end == -1)
+                break;
+            spans.last().source = {pos, end};
+            pos = end;
+        } else if (inMessage && startsWithTag(pos, "<translation")) {
+            const qint64 end = elementEnd(pos, "</translation>");
+            if (end == -1)
+                break;
+            spans.last().translation = {pos, end};
+            pos = end;
+        } else {
+            if (matchesAt(pos, "</message>"))
+                inMessage = false;
+            ++pos;
+        }
+    }
+    return spans;
+}
+
+/// @brief Decodes the text of the element spanning the given bytes, such as a <source> element.
+static QString elementText(const char *data, const ByteSpan &span)
+{
+    QXmlStreamReader xml(QByteArray::fromRawData(data + span.begin, span.end - span.begin));
+    return xml.readNextStartElement() ? xml.readElementText() : QString();
+}
+
+/// @brief Serializes the <translation> element of a message.
+/// @details Filled translations lose the "unfinished" type, like in writeTsFile(); other
+/// types such as "vanished" or "obsolete" are kept.
+QByteArray translationElement(const MessageInfo &msg)
+{
+    QString type = msg.translationType;
+    if (msg.translation.isEmpty())
+        type = QStringLiteral("unfinished");
+    else if (type == QLatin1String("unfinished"))
+        type.clear();
+
+    QByteArray element("<translation");
+    if (!type.isEmpty())
+        element += " type=\"" + type.toHtmlEscaped().toUtf8() + '"';
+    element += '>';
+    element += msg.translation.toHtmlEscaped().toUtf8();
+    element += "</translation>";
+    return element;
+}
+
+bool writeTsFileIncremental(const QString &sourcePath, const QString &filePath, const Catalog &catalog)
+{
+    // Catalog messages are in document order, so the changes come out sorted by ordinal.
+    QList<const MessageInfo *> changed;
+    int messageCount = 0;
+    for (const MessageInfo &msg : catalog.messages()) {
+        messageCount = qMax(messageCount, msg.ordinal + 1);
+        if (msg.locationsModified) {
+            qDebug() << "Locations changed, rewriting TS file completely:" << filePath;
+            return writeTsFile(filePath, catalog);
+        }
+        if (msg.isModified())
+            changed.append(&msg);
+    }
+    const bool samePath = QFileInfo(sourcePath) == QFileInfo(filePath);
+    if (changed.isEmpty() && samePath)
+        return true;
+
+    QByteArray output;
+    {
+        QFile source(sourcePath);
+        if (FileStamp::of(sourcePath) != catalog.sourceStamp() || !source.open(QIODevice::ReadOnly)) {
+            qWarning() << "TS file changed since it was parsed, rewriting it completely:" << sourcePath;
+            return writeTsFile(filePath, catalog);
+        }
+        const QByteArray original = source.readAll();
+        const QList<MessageSpans> spans = scanMessageSpans(original.constData(), original.size());
+        if (spans.size() != messageCount) {
+            qWarning() << "TS file changed since it was parsed, rewriting it completely:" << sourcePath;
+            return writeTsFile(filePath, catalog);
+        }
+
+        output.reserve(original.size() + changed.size() * 64);
+        qint64 copied = 0;
+        for (const MessageInfo *msg : std::as_const(changed)) {
+            const MessageSpans &span = spans.at(msg->ordinal);
+            if (span.translation.begin < 0 || span.source.begin < 0
+                || elementText(original.constData(), span.source) != msg->source) {
+                qWarning() << "TS file does not match the parsed message, rewriting it completely:" << msg->source;
+                return writeTsFile(filePath, catalog);
+            }
+            output.append(original.constData() + copied, span.translation.begin - copied);
+            output.append(translationElement(*msg));
+            copied = span.translation.end;
+        }
+        output.append(original.constData() + copied, original.size() - copied);
+    }
+
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(output) != output.size() || !file.commit()) {
+        qWarning() << "Unable to write file:" << filePath;
+        return false;
+    }
+    qDebug() << "Updated" << changed.size() << "translations in" << filePath;
+    return true;
+}
+
+/// @brief Quotes the CSV field appended to a buffer from the given offset, if it needs quotes.
+/// @details One scan over the field's bytes counts its quotes and looks for delimiters and
+/// line breaks. Only a field that has any is moved right in place, with its quotes doubled.
+static void quoteCsvFieldFrom(QByteArray &out, qsizetype start)
+{
+    qsizetype quotes = 0;
+    bool special = false;
+    for (qsizetype i = start; i < out.size(); ++i) {
+        const char c = out.at(i);
+        if (c == '"')
+            ++quotes;
+        else if (c == ',' || c == '\n' || c == '\r')
+            special = true;
+    }
+    if (quotes == 0 && !special)
+        return;
+
+    const qsizetype last = out.size() - 1;
+    out.resize(out.size() + quotes + 2);
+    char *data = out.data();
+    qsizetype to = out.size() - 1;
+    data[to] = '"';
+    for (qsizetype from = last; from >= start; --from) {
+        data[--to] = data[from];
+        if (data[from] == '"')
+            data[--to] = '"';
+    }
+    data[start] = '"';
+}
+
+/// @brief Appends a text as a CSV field, encoded straight into the buffer.
+static void appendCsvField(QByteArray &out, QStringView field, QStringEncoder &encoder)
+{
+    const qsizetype start = out.size();
+    out.resize(start + encoder.requiredSpace(field.size()));
+    const char *end = encoder.appendToBuffer(out.data() + start, field);
+    out.resize(end - out.constData());
+    quoteCsvFieldFrom(out, start);
+}
+
+/// Messages from which a CSV export is formatted on all cores.
+const int kParallelCsvMessages = 20000;
+
+/// @brief Formats the CSV rows of a range of messages.
+/// @param fileNames UTF-8 location filenames by ID, filled as they are needed.
+static QByteArray formatCsvRows(const Catalog &catalog, int firstMessage, int endMessage, bool changedOnly)
+{
+    QStringEncoder encoder(QStringEncoder::Utf8);
+    QList<QByteArray> fileNames;
+    QByteArray out;
+    out.reserve(qsizetype(endMessage - firstMessage) * 96);
+
+    for (int id = firstMessage; id < endMessage; ++id) {
+        const MessageInfo &msg = catalog.message(id);
+        if (changedOnly && !msg.isModified())
+            continue;
+        appendCsvField(out, msg.source, encoder);
+        out += ',';
+        appendCsvField(out, msg.translation, encoder);
+        out += ',';
+        appendCsvField(out, msg.translationType, encoder);
+        out += ',';
+
+        // "filename:line" pairs separated by semicolons, from filenames encoded once.
+        const qsizetype locationsStart = out.size();
+        bool first = true;
+        for (const Location &loc : catalog.locations(msg)) {
+            if (loc.fileId >= quint32(fileNames.size()))
+                fileNames.resize(loc.fileId + 1);
+            QByteArray &fileName = fileNames[loc.fileId];
+            if (fileName.isNull())
+                fileName = loc.filename().toUtf8();
+            if (!first)
+                out += "; ";
+            first = false;
+            char line[16];
+            const auto converted = std::to_chars(line, line + sizeof(line), loc.line);
+            out += fileName;
+            out += ':';
+            out.append(line, converted.ptr - line);
+        }
+        quoteCsvFieldFrom(out, locationsStart);
+        out += ',';
+        appendCsvField(out, catalog.contextName(msg), encoder);
+        out += '\n';
+    }
+    return out;
+}
+
+bool exportToCsv(const QString &csvFilePath, const Catalog &catalog, bool changedOnly)
+{
+    QFile file(csvFilePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Cannot open CSV file for writing:" << csvFilePath;
+        return false;
+    }
+
+    // Shards of whole contexts with about the same number of messages are formatted in
+    // parallel, then written back to back in document order.
+    QList<QPair<int, int>> shards;
+    const int shardCount = catalog.messageCount() < kParallelCsvMessages ? 1 : qMax(1, QThread::idealThreadCount());
+    const int target = catalog.messageCount() / shardCount + 1;
+    for (const ContextInfo &context : catalog.contexts()) {
+        const int end = context.firstMessage + context.messageCount;
+        if (shards.isEmpty() || shards.last().second - shards.last().first >= target)
+            shards.append({context.firstMessage, end});
+        else
+            shards.last().second = end;
+    }
+    const QList<QByteArray> rows = QtConcurrent::blockingMapped<QList<QByteArray>>(
+        shards, [&catalog, changedOnly](const QPair<int, int> &shard) {
+            return formatCsvRows(catalog, shard.first, shard.second, changedOnly);
+        });
+
+    bool written = file.write("source,translation,translationType,locations,context\n") >= 0;
+    for (const QByteArray &shard : rows)
+        written = written && file.write(shard) == shard.size();
+    if (!written) {
+        qWarning() << "Failed to write CSV file:" << csvFilePath << file.errorString();
+        return false;
+    }
+    file.close();
+    return true;
+}
+
+/// @brief RFC 4180 CSV reader working directly on a UTF-8 buffer.
+/// @details A state machine that scans the buffer once and builds every field from a slice
+/// of it, so nothing is appended character by character. Quoted fields may contain commas,
+/// doubled quotes and line breaks; records end at LF or CRLF. A leading UTF-8 BOM is skipped.
+class CsvReader
+{
+public:
+    /// @param data The CSV bytes. Must outlive the reader.
+    /// @param size The number of bytes.
+    /// @param skipBom If true a UTF-8 byte order mark at the start is skipped.
+    CsvReader(const char *data, qsizetype size, bool skipBom = true)
+        : m_pos(data)
+        , m_end(data + size)
+    {
+        if (skipBom && size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+            m_pos += 3;
+    }
+
+    /// @brief Reads the next record.
+    /// @param fields Receives the fields of the record.
+    /// @return False if the buffer has been consumed.
+    bool readRecord(QStringList &fields)
+    {
+        fields.clear();
+        if (m_pos >= m_end)
+            return false;
+        for (;;) {
+            if (*m_pos == '"')
+                fields.append(readQuotedField());
+            else
+                fields.append(readPlainField());
+            if (m_pos >= m_end)
+                return true;
+            const char delimiter = *m_pos++;
+            if (delimiter == ',') {
+                if (m_pos >= m_end) {
+                    fields.append(QString());
+                    return true;
+                }
+                continue;
+            }
+            if (delimiter == '\r' && m_pos < m_end && *m_pos == '\n')
+                ++m_pos;
+            return true;
+        }
+    }
+
+    /// @brief Moves past the next record without building its fields.
+    /// @details Follows the same rules as readRecord(), so a buffer can be cut at the
+    /// position() it leaves and both parts read to the same records.
+    /// @return False if the buffer has been consumed.
+    bool skipRecord()
+    {
+        if (m_pos >= m_end)
+            return false;
+        for (;;) {
+            if (*m_pos == '"') {
+                const char *closing = closingQuote(m_pos + 1, nullptr);
+                m_pos = fieldEnd(closing < m_end ? closing + 1 : m_end);
+            } else {
+                m_pos = fieldEnd(m_pos);
+            }
+            if (m_pos >= m_end)
+                return true;
+            const char delimiter = *m_pos++;
+            if (delimiter == ',') {
+                if (m_pos >= m_end)
+                    return true;
+                continue;
+            }
+            if (delimiter == '\r' && m_pos < m_end && *m_pos == '\n')
+                ++m_pos;
+            return true;
+        }
+    }
+
+    /// @brief The next byte to read.
+    const char *position() const { return m_pos; }
+
+    /// @brief Reads all remaining records.
+    QList<QStringList> readAll()
+    {
+        QList<QStringList> records;
+        QStringList fields;
+        while (readRecord(fields))
+            records.append(fields);
+        return records;
+    }
+
+private:
+    const char *fieldEnd(const char *from) const
+    {
+        while (from < m_end && *from != ',' && *from != '\n' && *from != '\r')
+            ++from;
+        return from;
+    }
+
+    QString readPlainField()
+    {
+        const char *start = m_pos;
+        m_pos = fieldEnd(m_pos);
+        return QString::fromUtf8(start, m_pos - start);
+    }
+
+    /// @brief The quote closing a quoted field whose text starts at @p from, or m_end if none.
+    /// @param doubledQuotes If not null, set to true when the field contains escaped quotes.
+    const char *closingQuote(const char *from, bool *doubledQuotes) const
+    {
+        while (from < m_end) {
+            const char *quote = static_cast<const char *>(memchr(from, '"', m_end - from));
+            if (!quote)
+                break;
+            if (quote + 1 < m_end && quote[1] == '"') {
+                if (doubledQuotes)
+                    *doubledQuotes = true;
+                from = quote + 2;
+                continue;
+            }
+            return quote;
+        }
+        return m_end;
+    }
+
+    QString readQuotedField()
+    {
+        const char *start = ++m_pos;
+        bool doubledQuotes = false;
+        const char *closing = closingQuote(start, &doubledQuotes);
+
+        QString field = QString::fromUtf8(start, closing - start);
+        if (doubledQuotes)
+            field.replace(QLatin1String("\"\""), QLatin1String("\""));
+        // Text mode writers on Windows turn embedded line breaks into CRLF.
+        if (memchr(start, '\r', closing - start))
+            field.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+
+        // Be lenient about text between the closing quote and the delimiter.
+        m_pos = closing < m_end ? closing + 1 : m_end;
+        const char *trailing = m_pos;
+        m_pos = fieldEnd(m_pos);
+        if (m_pos > trailing)
+            field += QString::fromUtf8(trailing, m_pos - trailing);
+        return field;
+    }
+
+    const char *m_pos;
+    const char *m_end;
+};
+
+/// CSV size in bytes from which records are parsed on all cores.
+const qsizetype kParallelCsvBytes = 4 * 1024 * 1024;
+
+// The buffer is cut with CsvReader::skipRecord(), so every chunk starts where the sequential
+// reader starts a record, whatever quotes the unquoted fields before it contain.
+QList<QStringList> readCsvRecords(const char *data, qsizetype size, int chunkCount)
+{
+    if (chunkCount <= 0)
+        chunkCount = size < kParallelCsvBytes ? 1 : QThread::idealThreadCount();
+    if (chunkCount <= 1)
+        return CsvReader(data, size).readAll();
+
+    const qsizetype target = qMax<qsizetype>(1, size / chunkCount);
+    QList<QPair<qsizetype, qsizetype>> chunks;
+    qsizetype chunkStart = 0;
+    CsvReader scanner(data, size);
+    while (scanner.skipRecord()) {
+        const qsizetype pos = scanner.position() - data;
+        if (pos - chunkStart >= target && pos < size) {
+            chunks.append({chunkStart, pos});
+            chunkStart = pos;
+        }
+    }
+    if (chunkStart < size)
+        chunks.append({chunkStart, size});
+
+    const QList<QList<QStringList>> parsed = QtConcurrent::blockingMapped<QList<QList<QStringList>>>(
+        chunks, [data](const QPair<qsizetype, qsizetype> &chunk) {
+            return CsvReader(data + chunk.first, chunk.second - chunk.first, chunk.first == 0).readAll();
+        });
+    QList<QStringList> records;
+    for (const QList<QStringList> &chunk : parsed)
+        records.append(chunk);
+    return records;
+}
+
+/// @brief Parses the locations column of a CSV row.
+/// @param locationsStr Locations in the format "filename:line", separated by semicolons.
+/// @return The locations that could be parsed.
+QList<Location> parseCsvLocations(const QString &locationsStr)
+{
+    QList<Location> locations;
+    QStringList locList = locationsStr.split(";", Qt::SkipEmptyParts);
+    for (QString locStr : locList) {
+        locStr = locStr.trimmed();
+        int colonIndex = locStr.lastIndexOf(':');
+        if (colonIndex != -1) {
+            QStringView filename = QStringView(locStr).left(colonIndex).trimmed();
+            bool ok = false;
+            int lineNumber = locStr.mid(colonIndex + 1).trimmed().toInt(&ok);
+            if (ok) {
+                locations.append({locationFileNames().intern(filename), lineNumber});
+            }
+        }
+    }
+    return locations;
+}
+
+bool importFromCsv(const QString &csvFilePath, Catalog &catalog)
+{
+    QFile file(csvFilePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot open CSV file for reading:" << csvFilePath;
+        return false;
+    }
+    qsizetype size = file.size();
+    QByteArray contents;
+    const char *data = size > 0 ? reinterpret_cast<const char *>(file.map(0, size)) : nullptr;
+    if (!data) {
+        // Not mappable (empty file, pipe, ...); read it instead.
+        contents = file.readAll();
+        data = contents.constData();
+        size = contents.size();
+    }
+    QList<QStringList> rows = readCsvRecords(data, size);
+    file.close();
+
+    // The header locates the optional context column.
+    QStringList header;
+    if (!rows.isEmpty())
+        header = rows.takeFirst();
+    const int contextColumn = header.indexOf("context");
+
+    // Index the messages by context plus source; the catalog already indexes them by source.
+    QHash<QString, QList<int>> byContext;
+    if (contextColumn >= 0) {
+        for (int id = 0; id < catalog.messageCount(); ++id) {
+            const MessageInfo &msg = catalog.message(id);
+            byContext[catalog.contextName(msg) + QChar(0x1F) + msg.source].append(id);
+        }
+    }
+
+    for (int row = 0; row < rows.size(); ++row) {
+        const QStringList &fields = rows.at(row);
+        if (fields.size() == 1 && fields.first().trimmed().isEmpty())
+            continue;
+        if (fields.size() < 4) {
+            qWarning() << "Invalid CSV record (not enough fields) at row" << row + 2 << ":" << fields;
+            continue;
+        }
+
+        QString source = fields[0];
+        QString translation = fields[1].trimmed();
+        QString translationType = fields[2];
+
+        // If there's no translation provided, skip this row.
+        if (translation.isEmpty())
+            continue;
+
+        QList<Location> newLocations = parseCsvLocations(fields[3]);
+
+        QList<int> matches;
+        if (contextColumn >= 0 && contextColumn < fields.size() && !fields[contextColumn].isEmpty()) {
+            matches = byContext.value(fields[contextColumn] + QChar(0x1F) + source);
+            if (matches.size() > 1 && !newLocations.isEmpty()) {
+                const Location &first = newLocations.first();
+                QList<int> atLocation;
+                for (int id : std::as_const(matches)) {
+                    for (const Location &loc : catalog.locations(catalog.message(id))) {
+                        if (loc.line == first.line && loc.fileId == first.fileId) {
+                            atLocation.append(id);
+                            break;
+                        }
+                    }
+                }
+                if (!atLocation.isEmpty())
+                    matches = atLocation;
+            }
+        }
+        // Rows without a context, or whose context no longer exists, match by source text.
+        if (matches.isEmpty())
+            matches = catalog.messagesWithSource(source);
+
+        for (int id : std::as_const(matches)) {
+            MessageInfo &msg = catalog.message(id);
+            msg.translation = translation;
+            msg.translationType = translationType;
+            // Optionally update locations if desired.
+            catalog.setLocations(id, newLocations);
+        }
+    }
+    return true;
+}
+
+namespace {
+
+/// Identifies a catalog snapshot file.
+const char kSnapshotMagic[8] = {'Q', 'A', 'T', 'S', 'N', 'A', 'P', 0};
+/// Incremented whenever the layout of the snapshot records changes.
+const quint32 kSnapshotVersion = 2;
+/// SnapshotMessage::flags bit of MessageInfo::locationsModified.
+const quint32 kSnapshotLocationsModified = 1;
+
+/// @brief The start of a snapshot file. Offsets are in bytes from the start of the file.
+struct SnapshotHeader {
+    char magic[8];
+    quint32 version;
+    quint32 sourcePath;     ///< String index of the TS file the catalog was parsed from.
+    qint64 sourceSize;      ///< Size of that file when the snapshot was written.
+    qint64 sourceModified;  ///< Its modification time in ms since the epoch.
+    quint32 stringCount;
+    quint32 contextCount;
+    quint32 messageCount;
+    quint32 locationCount;
+    quint64 stringIndexOffset; ///< SnapshotString records.
+    quint64 stringDataOffset;  ///< UTF-16 text of all strings.
+    quint64 contextOffset;     ///< SnapshotContext records.
+    quint64 messageOffset;     ///< SnapshotMessage records.
+    quint64 locationOffset;    ///< SnapshotLocation records.
+    quint64 fileSize;
+};
+
+struct SnapshotString {
+    quint32 offset; ///< Position in the string data, in UTF-16 code units.
+    quint32 length; ///< Length in UTF-16 code units.
+};
+
+struct SnapshotContext {
+    quint32 name;
+    quint32 messageCount;
+};
+
+struct SnapshotMessage {
+    quint32 source;
+    quint32 translation;
+    quint32 translationType;
+    quint32 originalTranslation;
+    quint32 originalType;
+    qint32 ordinal;
+    quint32 locationCount;
+    quint32 flags;
+};
+
+struct SnapshotLocation {
+    quint32 fileName;
+    qint32 line;
+};
+
+/// @brief Collects the distinct strings of a snapshot and gives each its index.
+class SnapshotStrings
+{
+public:
+    quint32 add(const QString &text)
+    {
+        auto it = m_index.constFind(text);
+        if (it != m_index.constEnd())
+            return it.value();
+        const quint32 index = quint32(m_records.size());
+        m_records.append({quint32(m_data.size()), quint32(text.size())});
+        m_data.append(text);
+        m_index.insert(text, index);
+        return index;
+    }
+
+    const QList<SnapshotString> &records() const { return m_records; }
+    const QString &data() const { return m_data; }
+
+private:
+    QHash<QString, quint32> m_index;
+    QList<SnapshotString> m_records;
+    QString m_data;
+};
+
+/// @brief Appends the bytes of a list of records to a buffer, returning where they start.
+template <typename Record>
+quint64 appendRecords(QByteArray &out, const Record *records, qsizetype count)
+{
+    const quint64 offset = quint64(out.size());
+    out.append(reinterpret_cast<const char *>(records), count * qsizetype(sizeof(Record)));
+    // Keep every block 8 byte aligned for the mapped reader.
+    out.append(QByteArray((8 - out.size() % 8) % 8, '\0'));
+    return offset;
+}
+
+} // namespace
+
+bool writeCatalogSnapshot(const QString &snapshotPath, const Catalog &catalog, const QString &sourcePath)
+{
+    SnapshotStrings strings;
+    QList<SnapshotContext> contexts;
+    QList<SnapshotMessage> messages;
+    QList<SnapshotLocation> locations;
+    contexts.reserve(catalog.contexts().size());
+    messages.reserve(catalog.messageCount());
+
+    QHash<quint32, quint32> fileNames; // StringTable ID to snapshot string index.
+    for (const ContextInfo &context : catalog.contexts()) {
+        contexts.append({strings.add(context.name), quint32(context.messageCount)});
+        for (int id = context.firstMessage; id < context.firstMessage + context.messageCount; ++id) {
+            const MessageInfo &msg = catalog.message(id);
+            const LocationRange range = catalog.locations(msg);
+            messages.append({strings.add(msg.source), strings.add(msg.translation), strings.add(msg.translationType),
+                             strings.add(msg.originalTranslation), strings.add(msg.originalType), qint32(msg.ordinal),
+                             quint32(range.size()), msg.locationsModified ? kSnapshotLocationsModified : 0});
+            for (const Location &loc : range) {
+                auto it = fileNames.constFind(loc.fileId);
+                if (it == fileNames.constEnd())
+                    it = fileNames.insert(loc.fileId, strings.add(loc.filename()));
+                locations.append({it.value(), qint32(loc.line)});
+            }
+        }
+    }
+
+    const QFileInfo source(sourcePath);
+    SnapshotHeader header{};
+    memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+    header.version = kSnapshotVersion;
+    header.sourcePath = strings.add(source.absoluteFilePath());
+    header.sourceSize = source.size();
+    header.sourceModified = source.lastModified().toMSecsSinceEpoch();
+    header.stringCount = quint32(strings.records().size());
+    header.contextCount = quint32(contexts.size());
+    header.messageCount = quint32(messages.size());
+    header.locationCount = quint32(locations.size());
+
+    QByteArray out;
+    out.reserve(qsizetype(sizeof(header)) + strings.data().size() * 2 + strings.records().size() * 8
+                + messages.size() * qsizetype(sizeof(SnapshotMessage)) + locations.size() * 8 + 64);
+    appendRecords(out, &header, 1);
+    header.stringIndexOffset = appendRecords(out, strings.records().constData(), strings.records().size());
+    header.stringDataOffset = appendRecords(out, strings.data().utf16(), strings.data().size());
+    header.contextOffset = appendRecords(out, contexts.constData(), contexts.size());
+    header.messageOffset = appendRecords(out, messages.constData(), messages.size());
+    header.locationOffset = appendRecords(out, locations.constData(), locations.size());
+    header.fileSize = quint64(out.size());
+    memcpy(out.data(), &header, sizeof(header));
+
+    QSaveFile file(snapshotPath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(out) != out.size() || !file.commit()) {
+        qWarning() << "Unable to write catalog snapshot:" << snapshotPath;
+        return false;
+    }
+    return true;
+}
+
+bool readCatalogSnapshot(const QString &snapshotPath, Catalog &catalog, const QString &sourcePath)
+{
+    QFile file(snapshotPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const qint64 size = file.size();
+    if (size < qint64(sizeof(SnapshotHeader)))
+        return false;
+    const char *data = reinterpret_cast<const char *>(file.map(0, size));
+    QByteArray contents;
+    if (!data) {
+        contents = file.readAll();
+        data = contents.constData();
+    }
+
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 || header.version != kSnapshotVersion) {
+        qWarning() << "Ignoring catalog snapshot of another format:" << snapshotPath;
+        return false;
+    }
+    auto fits = [&](quint64 offset, quint64 count, quint64 recordSize) {
+        return offset <= quint64(size) && count <= (quint64(size) - offset) / recordSize;
+    };
+    if (header.fileSize != quint64(size) || !fits(header.stringIndexOffset, header.stringCount, sizeof(SnapshotString))
+        || !fits(header.contextOffset, header.contextCount, sizeof(SnapshotContext))
+        || !fits(header.messageOffset, header.messageCount, sizeof(SnapshotMessage))
+        || !fits(header.locationOffset, header.locationCount, sizeof(SnapshotLocation))) {
+        qWarning() << "Ignoring truncated catalog snapshot:" << snapshotPath;
+        return false;
+    }
+
+    const auto *stringRecords = reinterpret_cast<const SnapshotString *>(data + header.stringIndexOffset);
+    const auto *text = reinterpret_cast<const QChar *>(data + header.stringDataOffset);
+    const quint64 textLength = (header.contextOffset - qMin(header.contextOffset, header.stringDataOffset)) / 2;
+    QList<QString> strings;
+    strings.reserve(header.stringCount);
+    for (quint32 i = 0; i < header.stringCount; ++i) {
+        const SnapshotString &record = stringRecords[i];
+        if (quint64(record.offset) + record.length > textLength)
+            return false;
+        strings.append(QString(text + record.offset, record.length));
+    }
+    auto string = [&strings](quint32 index) { return index < quint32(strings.size()) ? strings.at(index) : QString(); };
+
+    // A snapshot of an older or newer version of the TS file does not describe it.
+    if (!sourcePath.isEmpty()) {
+        const QFileInfo source(sourcePath);
+        if (string(header.sourcePath) != source.absoluteFilePath() || header.sourceSize != source.size()
+            || header.sourceModified != source.lastModified().toMSecsSinceEpoch())
+            return false;
+    }
+
+    QHash<quint32, quint32> fileIds; // Snapshot string index to StringTable ID.
+    const auto *contexts = reinterpret_cast<const SnapshotContext *>(data + header.contextOffset);
+    const auto *messages = reinterpret_cast<const SnapshotMessage *>(data + header.messageOffset);
+    const auto *locations = reinterpret_cast<const SnapshotLocation *>(data + header.locationOffset);
+    Catalog result;
+    quint32 message = 0;
+    quint32 location = 0;
+    QList<Location> messageLocations;
+    for (quint32 c = 0; c < header.contextCount; ++c) {
+        result.addContext(string(contexts[c].name));
+        for (quint32 m = 0; m < contexts[c].messageCount; ++m, ++message) {
+            if (message >= header.messageCount)
+                return false;
+            const SnapshotMessage &record = messages[message];
+            if (quint64(location) + record.locationCount > header.locationCount)
+                return false;
+            MessageInfo msg;
+            msg.source = string(record.source);
+            msg.translation = string(record.translation);
+            msg.translationType = string(record.translationType);
+            msg.originalTranslation = string(record.originalTranslation);
+            msg.originalType = string(record.originalType);
+            msg.ordinal = record.ordinal;
+            msg.locationsModified = record.flags & kSnapshotLocationsModified;
+            messageLocations.clear();
+            for (quint32 l = 0; l < record.locationCount; ++l, ++location) {
+                auto it = fileIds.constFind(locations[location].fileName);
+                if (it == fileIds.constEnd())
+                    it = fileIds.insert(locations[location].fileName,
+                                        locationFileNames().intern(string(locations[location].fileName)));
+                messageLocations.append({it.value(), locations[location].line});
+            }
+            result.addMessage(std::move(msg), messageLocations);
+        }
+    }
+    result.setSourceStamp({header.sourceSize, header.sourceModified});
+    catalog = std::move(result);
+    return true;
+}
+
+QString readApiKeyFromFile(const QString &apiKeyPath)
+{
+    QFile keyFile(apiKeyPath);
+    if (!keyFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Unable to open API key file:" << apiKeyPath;
+        return QString();
+    }
+
+    QByteArray raw = keyFile.readAll();
+    if (raw.startsWith("\xEF\xBB\xBF")) {
+        raw.remove(0, 3);
+    }
+    QString key = QString::fromUtf8(raw).trimmed();
+    keyFile.close();
+    return key;
+}
+
+int selectMessages(Catalog &catalog, const QStringList &translateTypes)
+{
+    int pending = 0;
+    for (MessageInfo &msg : catalog.messages()) {
+        msg.pending = !msg.source.isEmpty()
+                      && (translateTypes.contains(msg.translationType)
+                          || (msg.translationType.isEmpty() && msg.translation.isEmpty()));
+        pending += msg.pending ? 1 : 0;
+    }
+    return pending;
+}
+
+QStringList collectUntranslatedSources(const QList<Catalog> &catalogs)
+{
+    QStringList sources;
+    QSet<QString> seen;
+    for (const Catalog &catalog : catalogs) {
+        for (const MessageInfo &msg : catalog.messages()) {
+            if (!msg.pending || seen.contains(msg.source))
+                continue;
+            seen.insert(msg.source);
+            sources.append(msg.source);
+        }
+    }
+    return sources;
+}
+
+QList<QStringList> collectSourcesByContext(const QList<Catalog> &catalogs, const QStringList &contextPriority)
+{
+    QList<QRegularExpression> patterns;
+    for (const QString &pattern : contextPriority)
+        patterns.append(QRegularExpression(QRegularExpression::wildcardToRegularExpression(pattern)));
+
+    // Order all contexts by the first pattern they match; the sort keeps document order otherwise.
+    struct ContextRef {
+        int priority;
+        const Catalog *catalog;
+        const ContextInfo *context;
+    };
+    QList<ContextRef> contexts;
+    for (const Catalog &catalog : catalogs) {
+        for (const ContextInfo &context : catalog.contexts()) {
+            int priority = int(patterns.size());
+            for (int i = 0; i < patterns.size(); ++i) {
+                if (patterns.at(i).match(context.name).hasMatch()) {
+                    priority = i;
+                    break;
+                }
+            }
+            contexts.append({priority, &catalog, &context});
+        }
+    }
+    std::stable_sort(contexts.begin(), contexts.end(),
+                     [](const ContextRef &a, const ContextRef &b) { return a.priority < b.priority; });
+
+    QList<QStringList> groups;
+    QHash<QString, int> groupOfContext;
+    QSet<QString> seen;
+    for (const ContextRef &ref : std::as_const(contexts)) {
+        auto group = groupOfContext.constFind(ref.context->name);
+        if (group == groupOfContext.constEnd()) {
+            group = groupOfContext.insert(ref.context->name, int(groups.size()));
+            groups.append(QStringList());
+        }
+        const int end = ref.context->firstMessage + ref.context->messageCount;
+        for (int id = ref.context->firstMessage; id < end; ++id) {
+            const MessageInfo &msg = ref.catalog->message(id);
+            if (!msg.pending || seen.contains(msg.source))
+                continue;
+            seen.insert(msg.source);
+            groups[group.value()].append(msg.source);
+        }
+    }
+    groups.removeIf([](const QStringList &group) { return group.isEmpty(); });
+    return groups;
+}
+
+bool needsTranslation(const LanguageJob &job, const QString &source)
+{
+    for (const TsFileJob &file : job.files) {
+        for (int id : file.catalog.messagesWithSource(source)) {
+            if (file.catalog.message(id).pending)
+                return true;
+        }
+    }
+    return false;
+}
+
+int estimateTokens(QStringView text)
+{
+    int ascii = 0;
+    int other = 0;
+    for (QChar c : text) {
+        if (c.unicode() < 0x80)
+            ++ascii;
+        else if (!c.isLowSurrogate())
+            ++other;
+    }
+    return (ascii + 3) / 4 + other;
+}
+
+/// Estimated tokens of the instructions and the system message, sent once per request.
+const int kRequestTokenOverhead = 80;
+
+/// @brief Estimates the prompt and completion tokens one phrase adds to a request.
+/// @details The phrase is charged its prompt line plus the expected completion, which echoes
+/// the source, adds a translation assumed half again as long and wraps both in a JSON object.
+int estimatePhraseTokens(const QString &phrase)
+{
+    // Braces, keys and quotes of one {"source": ..., "translation": ...} object.
+    const int phraseOverhead = 12;
+    const int sourceTokens = estimateTokens(phrase);
+    return sourceTokens + sourceTokens + (sourceTokens * 3 + 1) / 2 + phraseOverhead;
+}
+
+int estimateBatchTokens(const QStringList &phrases)
+{
+    int tokens = kRequestTokenOverhead;
+    for (const QString &phrase : phrases)
+        tokens += estimatePhraseTokens(phrase);
+    return tokens;
+}
+
+int estimatePromptTokens(const QStringList &phrases)
+{
+    int tokens = kRequestTokenOverhead;
+    for (const QString &phrase : phrases)
+        tokens += estimateTokens(phrase);
+    return tokens;
+}
+
+int estimateCompletionTokens(const QStringList &phrases)
+{
+    return estimateBatchTokens(phrases) - estimatePromptTokens(phrases);
+}
+
+/// Time of a request apart from generating its completion: connection, queueing and prompt processing.
+const int kPlanRequestOverheadMs = 500;
+
+qint64 estimateDurationMs(const QList<QStringList> &batches, const BackendConfig &backend, int tokensPerSecond)
+{
+    double requestMs = 0;
+    qint64 tokens = 0;
+    for (const QStringList &batch : batches) {
+        requestMs += kPlanRequestOverheadMs + estimateCompletionTokens(batch) * 1000.0 / qMax(1, tokensPerSecond);
+        tokens += estimateBatchTokens(batch);
+    }
+    double duration = requestMs / qMax(1, backend.maxConcurrentRequests);
+    const int requests = int(batches.size());
+    if (backend.requestsPerMinute > 0)
+        duration = qMax(duration, qMax(0, requests - backend.requestsPerMinute) * 60000.0 / backend.requestsPerMinute);
+    if (backend.tokensPerMinute > 0)
+        duration = qMax(duration, qMax<qint64>(0, tokens - backend.tokensPerMinute) * 60000.0 / backend.tokensPerMinute);
+    return qint64(duration);
+}
+
+QList<QStringList> packBatches(const QStringList &phrases, int maxTokens, int maxPhrases)
+{
+    return packGroupedBatches({phrases}, maxTokens, maxPhrases);
+}
+
+QList<QStringList> packGroupedBatches(const QList<QStringList> &groups, int maxTokens, int maxPhrases)
+{
+    QList<QStringList> batches;
+    QStringList batch;
+    int batchTokens = kRequestTokenOverhead;
+    maxPhrases = qMax(1, maxPhrases);
+    auto fits = [&](qsizetype phrases, int tokens) {
+        return phrases <= maxPhrases && (maxTokens <= 0 || tokens <= maxTokens);
+    };
+    auto flush = [&]() {
+        if (!batch.isEmpty())
+            batches.append(batch);
+        batch.clear();
+        batchTokens = kRequestTokenOverhead;
+    };
+
+    for (const QStringList &group : groups) {
+        QList<int> costs;
+        int groupTokens = 0;
+        for (const QString &phrase : group) {
+            costs.append(estimatePhraseTokens(phrase));
+            groupTokens += costs.last();
+        }
+        if (!fits(batch.size() + group.size(), batchTokens + groupTokens))
+            flush();
+        if (fits(batch.size() + group.size(), batchTokens + groupTokens)) {
+            batch.append(group);
+            batchTokens += groupTokens;
+            continue;
+        }
+
+        // The group does not fit a batch of its own; split it phrase by phrase.
+        for (int i = 0; i < group.size(); ++i) {
+            if (!batch.isEmpty() && !fits(batch.size() + 1, batchTokens + costs.at(i)))
+                flush();
+            batch.append(group.at(i));
+            batchTokens += costs.at(i);
+        }
+    }
+    flush();
+    return batches;
+}
+
+bool applyTranslation(Catalog &catalog, const QString &source, const QString &translation)
+{
+    if (source.isEmpty())
+        return false;
+    bool applied = false;
+    for (int id : catalog.messagesWithSource(source)) {
+        MessageInfo &msg = catalog.message(id);
+        if (!msg.pending)
+            continue;
+        msg.translation = translation;
+        msg.pending = false;
+        applied = true;
+    }
+    return applied;
+}
+
+int carryOverTranslations(Catalog &updated, const Catalog &previous)
+{
+    // Context name and source, separated by a character that appears in neither.
+    auto key = [](const QString &context, const QString &source) { return context + QChar(0x1F) + source; };
+
+    QHash<QString, int> translated;
+    for (int id = 0; id < previous.messageCount(); ++id) {
+        const MessageInfo &msg = previous.message(id);
+        if (!msg.pending && !msg.translation.isEmpty())
+            translated.insert(key(previous.contextName(msg), msg.source), id);
+    }
+
+    int pending = 0;
+    for (int id = 0; id < updated.messageCount(); ++id) {
+        MessageInfo &msg = updated.message(id);
+        if (!msg.pending)
+            continue;
+        const int previousId = translated.value(key(updated.contextName(msg), msg.source), -1);
+        if (previousId < 0) {
+            ++pending;
+            continue;
+        }
+        const MessageInfo &before = previous.message(previousId);
+        msg.translation = before.translation;
+        msg.translationType = before.translationType;
+        msg.pending = false;
+    }
+    return pending;
+}
+
+/// @brief Appends a Unicode code point to a UTF-8 buffer.
+static void appendUtf8(QByteArray &out, uint codePoint)
+{
+    if (codePoint < 0x80) {
+        out.append(char(codePoint));
+    } else if (codePoint < 0x800) {
+        out.append(char(0xC0 | (codePoint >> 6)));
+        out.append(char(0x80 | (codePoint & 0x3F)));
+    } else if (codePoint < 0x10000) {
+        out.append(char(0xE0 | (codePoint >> 12)));
+        out.append(char(0x80 | ((codePoint >> 6) & 0x3F)));
+        out.append(char(0x80 | (codePoint & 0x3F)));
+    } else {
+        out.append(char(0xF0 | (codePoint >> 18)));
+        out.append(char(0x80 | ((codePoint >> 12) & 0x3F)));
+        out.append(char(0x80 | ((codePoint >> 6) & 0x3F)));
+        out.append(char(0x80 | (codePoint & 0x3F)));
+    }
+}
+
+/// @brief Appends the JSON escape of a quote, backslash or control character.
+/// @return False if the character is written as it is.
+static bool appendJsonEscape(QByteArray &out, char16_t c)
+{
+    switch (c) {
+    case '"': out.append("\\\"", 2); return true;
+    case '\\': out.append("\\\\", 2); return true;
+    case '\n': out.append("\\n", 2); return true;
+    case '\r': out.append("\\r", 2); return true;
+    case '\t': out.append("\\t", 2); return true;
+    case '\b': out.append("\\b", 2); return true;
+    case '\f': out.append("\\f", 2); return true;
+    default:
+        if (c >= 0x20)
+            return false;
+        static const char hex[] = "0123456789abcdef";
+        out.append("\\u00", 4);
+        out.append(hex[c >> 4]);
+        out.append(hex[c & 0xF]);
+        return true;
+    }
+}
+
+void appendJsonEscaped(QByteArray &out, QStringView text)
+{
+    const char16_t *data = text.utf16();
+    const qsizetype size = text.size();
+    for (qsizetype i = 0; i < size; ++i) {
+        const char16_t c = data[i];
+        if (c < 0x80) {
+            if (!appendJsonEscape(out, c))
+                out.append(char(c));
+        } else if (QChar::isHighSurrogate(c) && i + 1 < size && QChar::isLowSurrogate(data[i + 1])) {
+            appendUtf8(out, QChar::surrogateToUcs4(c, data[i + 1]));
+            ++i;
+        } else {
+            appendUtf8(out, QChar::isSurrogate(c) ? 0xFFFD : uint(c));
+        }
+    }
+}
+
+void appendJsonEscaped(QByteArray &out, QByteArrayView utf8)
+{
+    for (const char c : utf8) {
+        if (!appendJsonEscape(out, uchar(c)))
+            out.append(c);
+    }
+}
+
+/// @brief Reads four hex digits of a \u escape.
+/// @return The code unit, or -1 if the digits are malformed.
+static int readHex4(const char *p, const char *end)
+{
+    if (end - p < 4)
+        return -1;
+    int value = 0;
+    for (int i = 0; i < 4; ++i) {
+        const char c = p[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9')
+            value |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            value |= c - 'A' + 10;
+        else
+            return -1;
+    }
+    return value;
+}
+
+/// @brief Reads the JSON string starting at the opening quote at p and advances p past it.
+/// @details Strings without escapes, the usual case, are converted in one go; others are
+/// unescaped into a UTF-8 buffer first.
+/// @return False if the string is unterminated or has a malformed escape.
+static bool readJsonString(const char *&p, const char *end, QString *out)
+{
+    const char *start = ++p;
+    while (p < end && *p != '"' && *p != '\\')
+        ++p;
+    if (p < end && *p == '"') {
+        *out = QString::fromUtf8(start, p - start);
+        ++p;
+        return true;
+    }
+
+    // Reused by the thread, as escapes are common in translations.
+    static thread_local QByteArray bytes;
+    bytes.resize(0);
+    bytes.append(start, p - start);
+    while (p < end && *p != '"') {
+        if (*p != '\\') {
+            bytes.append(*p++);
+            continue;
+        }
+        if (++p == end)
+            return false;
+        switch (*p++) {
+        case '"': bytes.append('"'); break;
+        case '\\': bytes.append('\\'); break;
+        case '/': bytes.append('/'); break;
+        case 'b': bytes.append('\b'); break;
+        case 'f': bytes.append('\f'); break;
+        case 'n': bytes.append('\n'); break;
+        case 'r': bytes.append('\r'); break;
+        case 't': bytes.append('\t'); break;
+        case 'u': {
+            int unit = readHex4(p, end);
+            if (unit < 0)
+                return false;
+            p += 4;
+            uint codePoint = uint(unit);
+            if (unit >= 0xD800 && unit < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                const int low = readHex4(p + 2, end);
+                if (low >= 0xDC00 && low < 0xE000) {
+                    codePoint = 0x10000 + ((uint(unit) - 0xD800) << 10) + (uint(low) - 0xDC00);
+                    p += 6;
+                }
+            }
+            appendUtf8(bytes, codePoint);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    if (p == end)
+        return false;
+    ++p;
+    *out = QString::fromUtf8(bytes);
+    return true;
+}
+
+bool FlatJsonObject::parse(const char *data, qsizetype size)
+{
+    m_members.clear();
+    const char *p = data;
+    const char *end = data + size;
+    auto skipSpace = [&]() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            ++p;
+    };
+
+    skipSpace();
+    if (p == end || *p++ != '{')
+        return false;
+    skipSpace();
+    if (p < end && *p == '}')
+        return true;
+    while (p < end) {
+        if (*p != '"')
+            return false;
+        const char *keyStart = ++p;
+        while (p < end && *p != '"') {
+            if (*p == '\\' && ++p == end)
+                return false;
+            ++p;
+        }
+        if (p == end)
+            return false;
+        const QByteArrayView key(keyStart, p++ - keyStart);
+        skipSpace();
+        if (p == end || *p++ != ':')
+            return false;
+        skipSpace();
+        if (p == end)
+            return false;
+        QString value;
+        if (*p == '"') {
+            if (!readJsonString(p, end, &value))
+                return false;
+        } else {
+            const char *start = p;
+            while (p < end && *p != ',' && *p != '}' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+                if (*p == '{' || *p == '[')
+                    return false;
+                ++p;
+            }
+            if (p == start)
+                return false;
+            value = QString::fromLatin1(start, p - start);
+        }
+        m_members.append({key, value});
+        skipSpace();
+        if (p == end)
+            return false;
+        if (*p == '}')
+            return true;
+        if (*p++ != ',')
+            return false;
+        skipSpace();
+    }
+    return false;
+}
+
+QString FlatJsonObject::value(QLatin1String key) const
+{
+    for (const auto &member : m_members) {
+        if (member.first == QByteArrayView(key.data(), key.size()))
+            return member.second;
+    }
+    return QString();
+}
+
+bool applyTranslation(LanguageJob &job, const QString &source, const QString &translation)
+{
+    bool applied = false;
+    for (TsFileJob &file : job.files)
+        applied = applyTranslation(file.catalog, source, translation) || applied;
+    return applied;
+}
+
+void applyTranslationObject(const QByteArray &object, LanguageJob &job, QHash<QString, QString> &applied,
+                            const QStringList &phrases)
+{
+    // Called for every entry of every response, so the member list is kept between calls.
+    static thread_local FlatJsonObject obj;
+    if (!obj.parse(object.constData(), object.size()))
+        return;
+    QString source;
+    QString translation;
+    const QString id = obj.value(QLatin1String("id"));
+    if (!id.isNull()) {
+        bool ok = false;
+        const int index = id.toInt(&ok);
+        if (!ok || index < 0 || index >= phrases.size())
+            return;
+        source = phrases.at(index);
+        translation = obj.value(QLatin1String("t"));
+    } else {
+        source = obj.value(QLatin1String("source"));
+        translation = obj.value(QLatin1String("translation"));
+    }
+    if (applyTranslation(job, source, translation))
+        applied.insert(source, translation);
+}
+
+QHash<QString, QString> processResponse(const QByteArray &responseData, LanguageJob &job, const QStringList &phrases)
+{
+    QHash<QString, QString> applied;
+    if (responseData.isEmpty())
+        return applied;
+
+    QList<QByteArray> objects;
+    {
+        StageTimer timer(QStringLiteral("response parse"));
+        QJsonDocument responseDoc = QJsonDocument::fromJson(responseData);
+        if (responseDoc.isNull() || !responseDoc.isObject()) {
+            qWarning() << "Failed to parse API response as JSON.";
+            return applied;
+        }
+        QJsonObject responseObj = responseDoc.object();
+        if (responseObj["usage"].isObject())
+            metrics().addUsage(responseObj["usage"].toObject());
+        QJsonArray choices = responseObj["choices"].toArray();
+        if (choices.isEmpty()) {
+            qWarning() << "No choices returned from API.";
+            return applied;
+        }
+        QJsonObject firstChoice = choices.first().toObject();
+        QJsonObject messageObj = firstChoice["message"].toObject();
+
+        // Code fences, surrounding prose and a cut off tail are skipped by the scanner.
+        JsonObjectScanner scanner;
+        scanner.feed(messageObj["content"].toString().toUtf8());
+        objects = scanner.takeObjects();
+        if (objects.isEmpty()) {
+            qWarning() << "No translation objects found in the response.";
+            return applied;
+        }
+    }
+
+    // Apply each returned translation to the messages with that source.
+    StageTimer timer(QStringLiteral("response apply"));
+    for (const QByteArray &object : std::as_const(objects))
+        applyTranslationObject(object, job, applied, phrases);
+    return applied;
+}
+
+qint64 parseResetDuration(const QByteArray &value)
+{
+    qint64 total = 0;
+    int pos = 0;
+    bool any = false;
+    while (pos < value.size()) {
+        int start = pos;
+        while (pos < value.size() && ((value[pos] >= '0' && value[pos] <= '9') || value[pos] == '.'))
+            ++pos;
+        bool ok = false;
+        const double number = value.mid(start, pos - start).toDouble(&ok);
+        if (!ok)
+            return -1;
+        start = pos;
+        while (pos < value.size() && value[pos] >= 'a' && value[pos] <= 'z')
+            ++pos;
+        const QByteArray unit = value.mid(start, pos - start);
+        if (unit == "ms")
+            total += qint64(number);
+        else if (unit == "s" || unit.isEmpty())
+            total += qint64(number * 1000);
+        else if (unit == "m")
+            total += qint64(number * 60 * 1000);
+        else if (unit == "h")
+            total += qint64(number * 60 * 60 * 1000);
+        else
+            return -1;
+        any = true;
+    }
+    return any ? total : -1;
+}
+
+qint64 retryAfterMs(const QNetworkReply *reply)
+{
+    bool ok = false;
+    const qint64 ms = reply->rawHeader("retry-after-ms").toLongLong(&ok);
+    if (ok)
+        return ms;
+    const QByteArray retryAfter = reply->rawHeader("Retry-After").trimmed();
+    if (retryAfter.isEmpty())
+        return -1;
+    const double seconds = retryAfter.toDouble(&ok);
+    if (ok)
+        return qint64(seconds * 1000);
+    const QDateTime at = QDateTime::fromString(QString::fromLatin1(retryAfter), Qt::RFC2822Date);
+    if (!at.isValid())
+        return -1;
+    return qMax<qint64>(0, QDateTime::currentDateTimeUtc().msecsTo(at));
+}
+
+QString suffixedPath(const QString &path, const QString &postfix)
+{
+    if (path.isEmpty() || postfix.isEmpty())
+        return path;
+    const QFileInfo info(path);
+    QString name = info.completeBaseName() + QLatin1Char('_') + postfix;
+    if (!info.suffix().isEmpty())
+        name += QLatin1Char('.') + info.suffix();
+    return QDir(info.path()).filePath(name);
+}
+
+QStringList expandTsFilePaths(const QString &path)
+{
+    const QFileInfo info(path);
+    QStringList nameFilters;
+    QDir dir;
+    if (info.isDir()) {
+        dir.setPath(path);
+        nameFilters << QStringLiteral("*.ts");
+    } else if (info.fileName().contains(QLatin1Char('*')) || info.fileName().contains(QLatin1Char('?'))
+               || info.fileName().contains(QLatin1Char('['))) {
+        dir.setPath(info.path());
+        nameFilters << info.fileName();
+    } else {
+        return {path};
+    }
+
+    QStringList files;
+    for (const QString &name : dir.entryList(nameFilters, QDir::Files, QDir::Name))
+        files.append(dir.filePath(name));
+    return files;
+}
+
+TsFileJob resolveTsFileJob(const Config &config, const TranslationTarget &target, const QString &tsFile,
+                           bool multiFile)
+{
+    TsFileJob file;
+    file.sourcePath = tsFile;
+    if (!multiFile) {
+        file.tsFilePath = target.tsFilePath;
+        file.csvToImport = target.csvToImport;
+        file.csvToExport = target.csvToExport;
+    } else {
+        file.tsFilePath = target.tsFilePath == config.tsFilePath ? tsFile : suffixedPath(tsFile, target.langPostfix);
+        const QString csvName = QFileInfo(file.tsFilePath).completeBaseName() + QStringLiteral(".csv");
+        if (!target.csvToImport.isEmpty())
+            file.csvToImport = QDir(QFileInfo(target.csvToImport).path()).filePath(csvName);
+        if (!target.csvToExport.isEmpty())
+            file.csvToExport = QDir(QFileInfo(target.csvToExport).path()).filePath(csvName);
+    }
+
+    // Named after the output and the language, as several languages may write in place.
+    if (!config.snapshotDir.isEmpty()) {
+        const QString snapshotName = QFileInfo(file.tsFilePath).fileName() + QStringLiteral(".qats");
+        file.snapshotPath = suffixedPath(QDir(config.snapshotDir).filePath(snapshotName), target.langPostfix);
+    }
+    return file;
+}
+
+Config loadConfig(const QString &configPath)
+{
+    QFile configFile(configPath);
+    if (!configFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qCritical() << "Config dosyası açılamadı!";
+        exit(1);
+    }
+
+    QByteArray jsonData = configFile.readAll();
+    configFile.close();
+
+    QJsonDocument jsonDoc = QJsonDocument::fromJson(jsonData);
+    if (!jsonDoc.isObject()) {
+        qCritical() << "Config dosyası geçersiz!";
+        exit(1);
+    }
+
+    QJsonObject jsonObj = jsonDoc.object();
+    Config config;
+    config.tsFilePath    = jsonObj["ts_file_path"].toString();
+    config.apiKeyPath    = jsonObj["api_key_path"].toString();
+    config.apiCallSize   = jsonObj["api_call_size"].toInt(50);
+    config.maxTokensPerRequest = jsonObj["max_tokens_per_request"].toInt(6000);
+    config.lang          = jsonObj["lang"].toString();
+    config.langPostfix   = jsonObj["lang_postfix"].toString();
+    config.csvToExport   = jsonObj["csv_to_export"].toString();
+    config.csvToImport   = jsonObj["csv_to_import"].toString();
+    config.exportToCSV   = jsonObj["export_to_csv"].toBool();
+    config.importFromCSV = jsonObj["import_from_csv"].toBool();
+    config.writeBackToTs = jsonObj["write_back_to_ts"].toBool();
+    config.maxConcurrentRequests = jsonObj["max_concurrent_requests"].toInt(4);
+    config.http2         = jsonObj["http2"].toBool(false);
+    config.model         = jsonObj["model"].toString("gpt-4o-mini");
+    config.translationMemoryPath = jsonObj["translation_memory_path"].toString();
+    config.requestsPerMinute = jsonObj["requests_per_minute"].toInt(0);
+    config.tokensPerMinute = jsonObj["tokens_per_minute"].toInt(0);
+    config.maxRetries    = jsonObj["max_retries"].toInt(5);
+    config.requestTimeoutMs = jsonObj["request_timeout_ms"].toInt(120000);
+    config.stream        = jsonObj["stream"].toBool(false);
+    config.structuredOutput = jsonObj["structured_output"].toBool(false);
+    config.checkpointPath = jsonObj["checkpoint_path"].toString();
+    config.mmapTs        = jsonObj["mmap_ts"].toBool(false);
+    config.parallelParse = jsonObj["parallel_parse"].toBool(false);
+    config.incrementalWrite = jsonObj["incremental_write"].toBool(true);
+    config.endpoint      = jsonObj["endpoint"].toString("https://api.openai.com/v1/chat/completions");
+    config.metricsReportPath = jsonObj["metrics_report_path"].toString();
+    config.progressIntervalMs = jsonObj["progress_interval_ms"].toInt(0);
+    config.translateTypes = QStringList{QStringLiteral("unfinished")};
+    if (jsonObj.contains("translate_types")) {
+        config.translateTypes.clear();
+        for (const QJsonValue &value : jsonObj["translate_types"].toArray())
+            config.translateTypes.append(value.toString());
+    }
+    for (const QJsonValue &value : jsonObj["context_priority"].toArray())
+        config.contextPriority.append(value.toString());
+    config.glossaryPath = jsonObj["glossary_path"].toString();
+    config.inputCostPerMillion = jsonObj["input_cost_per_million"].toDouble(0.0);
+    config.outputCostPerMillion = jsonObj["output_cost_per_million"].toDouble(0.0);
+    config.planTokensPerSecond = jsonObj["plan_tokens_per_second"].toInt(50);
+    config.exportChangedOnly = jsonObj["export_changed_only"].toBool(false);
+    config.adaptiveBatching = jsonObj["adaptive_batching"].toBool(false);
+    config.adaptiveMaxBatchSize = jsonObj["adaptive_max_batch_size"].toInt(2 * config.apiCallSize);
+    config.snapshotDir = jsonObj["snapshot_dir"].toString();
+
+    // Several languages can be translated from one source TS file in a single run. Each target
+    // that names no output files of its own gets the shared ones suffixed with its postfix.
+    const QJsonArray targets = jsonObj["targets"].toArray();
+    for (const QJsonValue &value : targets) {
+        const QJsonObject targetObj = value.toObject();
+        TranslationTarget target;
+        target.lang        = targetObj["lang"].toString();
+        target.langPostfix = targetObj["lang_postfix"].toString();
+        target.tsFilePath  = targetObj["ts_file_path"].toString(suffixedPath(config.tsFilePath, target.langPostfix));
+        target.csvToImport = targetObj["csv_to_import"].toString(suffixedPath(config.csvToImport, target.langPostfix));
+        target.csvToExport = targetObj["csv_to_export"].toString(suffixedPath(config.csvToExport, target.langPostfix));
+        config.targets.append(target);
+    }
+    if (config.targets.isEmpty()) {
+        TranslationTarget target;
+        target.lang        = config.lang;
+        target.langPostfix = config.langPostfix;
+        target.tsFilePath  = config.tsFilePath;
+        target.csvToImport = config.csvToImport;
+        target.csvToExport = config.csvToExport;
+        config.targets.append(target);
+    }
+
+    // Backends are tried in order: the first gets every batch, later ones what the earlier
+    // ones give up on. Limits not given by a backend are taken from the top-level settings;
+    // the API key is not, so that it is only sent where it is configured.
+    const QJsonArray backends = jsonObj["backends"].toArray();
+    for (const QJsonValue &value : backends) {
+        const QJsonObject backendObj = value.toObject();
+        BackendConfig backend;
+        backend.name        = backendObj["name"].toString(QStringLiteral("backend %1").arg(config.backends.size() + 1));
+        backend.endpoint    = backendObj["endpoint"].toString(config.endpoint);
+        backend.model       = backendObj["model"].toString(config.model);
+        backend.apiKeyPath  = backendObj["api_key_path"].toString();
+        backend.maxConcurrentRequests = backendObj["max_concurrent_requests"].toInt(config.maxConcurrentRequests);
+        backend.requestsPerMinute = backendObj["requests_per_minute"].toInt(config.requestsPerMinute);
+        backend.tokensPerMinute = backendObj["tokens_per_minute"].toInt(config.tokensPerMinute);
+        backend.requestTimeoutMs = backendObj["request_timeout_ms"].toInt(config.requestTimeoutMs);
+        backend.http2       = backendObj["http2"].toBool(config.http2);
+        backend.stream      = backendObj["stream"].toBool(config.stream);
+        backend.structuredOutput = backendObj["structured_output"].toBool(config.structuredOutput);
+        backend.inputCostPerMillion = backendObj["input_cost_per_million"].toDouble(config.inputCostPerMillion);
+        backend.outputCostPerMillion = backendObj["output_cost_per_million"].toDouble(config.outputCostPerMillion);
+        config.backends.append(backend);
+    }
+    if (config.backends.isEmpty()) {
+        BackendConfig backend;
+        backend.name        = config.model;
+        backend.endpoint    = config.endpoint;
+        backend.model       = config.model;
+        backend.apiKeyPath  = config.apiKeyPath;
+        backend.maxConcurrentRequests = config.maxConcurrentRequests;
+        backend.requestsPerMinute = config.requestsPerMinute;
+        backend.tokensPerMinute = config.tokensPerMinute;
+        backend.requestTimeoutMs = config.requestTimeoutMs;
+        backend.http2       = config.http2;
+        backend.stream      = config.stream;
+        backend.structuredOutput = config.structuredOutput;
+        backend.inputCostPerMillion = config.inputCostPerMillion;
+        backend.outputCostPerMillion = config.outputCostPerMillion;
+        config.backends.append(backend);
+    }
+
+    return config;
+}
+
+QByteArray &RequestBufferPool::acquire()
+{
+    for (QByteArray &buffer : m_buffers) {
+        if (!buffer.isNull() && buffer.isDetached()) {
+            buffer.resize(0);
+            return buffer;
+        }
+    }
+    m_buffers.append(QByteArray());
+    m_buffers.last().reserve(m_largest);
+    return m_buffers.last();
+}
+
+void JsonObjectScanner::scan()
+{
+    for (; m_pos < m_buffer.size(); ++m_pos) {
+        const char c = m_buffer.at(m_pos);
+        if (m_inString) {
+            if (m_escaped)
+                m_escaped = false;
+            else if (c == '\\')
+                m_escaped = true;
+            else if (c == '"')
+                m_inString = false;
+        } else if (c == '"') {
+            m_inString = !m_stack.isEmpty();
+        } else if (c == '{') {
+            if (!m_stack.isEmpty())
+                m_stack.last().hasChild = true;
+            m_stack.append({m_pos, false});
+        } else if (c == '}' && !m_stack.isEmpty()) {
+            const Frame frame = m_stack.takeLast();
+            if (!frame.hasChild)
+                m_objects.append(m_buffer.mid(frame.start, m_pos - frame.start + 1));
+        }
+    }
+
+    // Drop what can no longer be part of an object.
+    const qsizetype keep = m_stack.isEmpty() ? m_pos : m_stack.first().start;
+    if (keep > 0) {
+        m_buffer.remove(0, keep);
+        m_pos -= keep;
+        for (Frame &frame : m_stack)
+            frame.start -= keep;
+    }
+}
+
+QList<QByteArray> SseReader::takeEvents()
+{
+    QList<QByteArray> events;
+    qsizetype start = 0;
+    qsizetype end;
+    while ((end = m_buffer.indexOf('\n', start)) != -1) {
+        const QByteArray line = m_buffer.mid(start, end - start).trimmed();
+        start = end + 1;
+        if (line.startsWith("data:"))
+            events.append(line.mid(5).trimmed());
+    }
+    m_buffer.remove(0, start);
+    return events;
+}
+
+void StreamedResponse::feed(const QByteArray &data)
+{
+    m_events.feed(data);
+    for (const QByteArray &event : m_events.takeEvents()) {
+        if (event == "[DONE]")
+            continue;
+        const QJsonObject chunk = QJsonDocument::fromJson(event).object();
+        // With include_usage the last chunk carries the token usage and no choices.
+        if (chunk["usage"].isObject())
+            metrics().addUsage(chunk["usage"].toObject());
+        const QJsonArray choices = chunk["choices"].toArray();
+        if (choices.isEmpty())
+            continue;
+        const QString delta = choices.first().toObject()["delta"].toObject()["content"].toString();
+        if (!delta.isEmpty())
+            m_objects.feed(delta.toUtf8());
+    }
+    for (const QByteArray &object : m_objects.takeObjects())
+        applyTranslationObject(object, m_job, m_applied, m_phrases);
+}
+
+bool Glossary::load(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Unable to open glossary:" << path;
+        return false;
+    }
+    QJsonParseError error;
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+    if (!document.isArray()) {
+        qWarning() << "Glossary is not a JSON array:" << path << error.errorString();
+        return false;
+    }
+
+    m_entries.clear();
+    m_entryOfTerm.clear();
+    QStringList patterns;
+    for (const QJsonValue &value : document.array()) {
+        const QJsonObject object = value.toObject();
+        Entry entry;
+        entry.term = object["term"].toString();
+        entry.note = object["note"].toString();
+        const QJsonObject translations = object["translations"].toObject();
+        for (auto it = translations.begin(); it != translations.end(); ++it)
+            entry.translations.insert(it.key(), it.value().toString());
+        if (entry.term.isEmpty() || m_entryOfTerm.contains(entry.term.toCaseFolded()))
+            continue;
+        m_entryOfTerm.insert(entry.term.toCaseFolded(), int(m_entries.size()));
+        m_entries.append(entry);
+        patterns.append(QRegularExpression::escape(entry.term));
+    }
+
+    // Longer terms first, so "Save As" wins over "Save".
+    std::stable_sort(patterns.begin(), patterns.end(),
+                     [](const QString &a, const QString &b) { return a.size() > b.size(); });
+    m_pattern = QRegularExpression(QStringLiteral("(?<!\\w)(?:%1)(?!\\w)").arg(patterns.join(QLatin1Char('|'))),
+                                   QRegularExpression::CaseInsensitiveOption
+                                       | QRegularExpression::UseUnicodePropertiesOption);
+    m_pattern.optimize();
+    qDebug() << "Glossary terms loaded:" << m_entries.size();
+    return true;
+}
+
+QString Glossary::promptSection(const QStringList &phrases, const QString &lang) const
+{
+    if (m_entries.isEmpty())
+        return QString();
+    QList<int> found;
+    for (const QString &phrase : phrases) {
+        QRegularExpressionMatchIterator matches = m_pattern.globalMatch(phrase);
+        while (matches.hasNext()) {
+            const int entry = m_entryOfTerm.value(matches.next().captured().toCaseFolded(), -1);
+            if (entry >= 0 && !found.contains(entry))
+                found.append(entry);
+        }
+    }
+    std::sort(found.begin(), found.end());
+
+    QString section;
+    for (int index : std::as_const(found)) {
+        const Entry &entry = m_entries.at(index);
+        const QString translation = entry.translations.value(lang);
+        if (translation.isEmpty() && entry.note.isEmpty())
+            continue;
+        section += entry.term;
+        if (!translation.isEmpty())
+            section += QLatin1String(" => ") + translation;
+        if (!entry.note.isEmpty())
+            section += QLatin1String(" (") + entry.note + QLatin1Char(')');
+        section += QLatin1Char('\n');
+    }
+    return section.isEmpty() ? section : QLatin1String("Glossary:\n") + section;
+}
+
+ChatCompletionsBackend::ChatCompletionsBackend(const BackendConfig &config, const QString &apiKey,
+                                               const Glossary *glossary)
+    : TranslationBackend(config)
+    , m_apiKey(apiKey)
+    , m_glossary(glossary)
+    , m_endpoint(config.endpoint)
+    , m_sslConfig(QSslConfiguration::defaultConfiguration())
+{
+    m_sslConfig.setProtocol(QSsl::TlsV1_2OrLater);
+    if (config.http2)
+        m_sslConfig.setAllowedNextProtocols({QSslConfiguration::ALPNProtocolHTTP2,
+                                             QSslConfiguration::NextProtocolHttp1_1});
+
+    // Everything but the user message is the same for every request, so it is built once.
+    QJsonObject head;
+    head["model"] = config.model;
+    head["temperature"] = 0;
+    if (config.structuredOutput)
+        head["response_format"] = structuredResponseFormat();
+    if (config.stream) {
+        head["stream"] = true;
+        head["stream_options"] = QJsonObject{{"include_usage", true}};
+    }
+    m_bodyPrefix = QJsonDocument(head).toJson(QJsonDocument::Compact);
+    m_bodyPrefix.chop(1);
+    m_bodyPrefix += ",\"messages\":[{\"role\":\"system\",\"content\":\"";
+    appendJsonEscaped(m_bodyPrefix, QByteArrayView(config.structuredOutput ? kStructuredSystemPrompt : kSystemPrompt));
+    m_bodyPrefix += "\"},{\"role\":\"user\",\"content\":\"";
+
+    m_request = QNetworkRequest(m_endpoint);
+    m_request.setAttribute(QNetworkRequest::Http2AllowedAttribute, config.http2);
+    m_request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+    if (!m_apiKey.isEmpty())
+        m_request.setRawHeader("Authorization", QString("Bearer %1").arg(m_apiKey).toUtf8());
+    m_request.setRawHeader("User-Agent", "QtGPTTranslator/1.0");
+    if (config.stream)
+        m_request.setRawHeader("Accept", "text/event-stream");
+    if (config.requestTimeoutMs > 0)
+        m_request.setTransferTimeout(config.requestTimeoutMs);
+    m_request.setSslConfiguration(m_sslConfig);
+}
+
+void ChatCompletionsBackend::warmUp()
+{
+    if (m_endpoint.scheme() == QLatin1String("http"))
+        m_networkManager.connectToHost(m_endpoint.host(), m_endpoint.port(80));
+    else
+        m_networkManager.connectToHostEncrypted(m_endpoint.host(), m_endpoint.port(443), m_sslConfig);
+}
+
+QNetworkReply *ChatCompletionsBackend::sendTranslationBatch(const QStringList &phrases, const QString &lang,
+                                                            const QString &langPostfix)
+{
+    StageTimer timer(QStringLiteral("request build"));
+    // The body is written straight into a pooled buffer, with the user message escaped
+    // on the way, instead of through a QJsonObject tree and its serialization.
+    QByteArray &body = m_bodies.acquire();
+    body += m_bodyPrefix;
+    body += "Translate the following phrases into ";
+    appendJsonEscaped(body, lang);
+    body += " (";
+    appendJsonEscaped(body, langPostfix);
+    body += ").\\n";
+    if (m_glossary)
+        appendJsonEscaped(body, m_glossary->promptSection(phrases, lang));
+    body += "Phrases:\\n";
+    // The phrase list is JSON inside the JSON string of the message, so it is escaped twice.
+    m_phraseList.resize(0);
+    if (config().structuredOutput) {
+        // Written by hand, as a QJsonObject would order the IDs as strings ("10" before "2").
+        m_phraseList += '{';
+        char id[16];
+        for (int i = 0; i < phrases.size(); ++i) {
+            m_phraseList += i > 0 ? ",\"" : "\"";
+            m_phraseList.append(id, qsnprintf(id, sizeof(id), "%d", i));
+            m_phraseList += "\":\"";
+            appendJsonEscaped(m_phraseList, phrases.at(i));
+            m_phraseList += '"';
+        }
+        m_phraseList += '}';
+    } else {
+        m_phraseList += '[';
+        for (int i = 0; i < phrases.size(); ++i) {
+            m_phraseList += i > 0 ? ",\"" : "\"";
+            appendJsonEscaped(m_phraseList, phrases.at(i));
+            m_phraseList += '"';
+        }
+        m_phraseList += ']';
+    }
+    appendJsonEscaped(body, m_phraseList);
+    body += "\"}]}";
+    m_bodies.release(body);
+
+    qDebug() << "Sending request with" << phrases.size() << "phrases to" << config().name;
+    return m_networkManager.post(m_request, body);
+}
+
+QJsonObject ChatCompletionsBackend::structuredResponseFormat()
+{
+    const QJsonObject item{
+        {"type", "object"},
+        {"properties", QJsonObject{{"id", QJsonObject{{"type", "integer"}}},
+                                   {"t", QJsonObject{{"type", "string"}}}}},
+        {"required", QJsonArray{"id", "t"}},
+        {"additionalProperties", false},
+    };
+    const QJsonObject schema{
+        {"type", "object"},
+        {"properties", QJsonObject{{"items", QJsonObject{{"type", "array"}, {"items", item}}}}},
+        {"required", QJsonArray{"items"}},
+        {"additionalProperties", false},
+    };
+    return QJsonObject{
+        {"type", "json_schema"},
+        {"json_schema", QJsonObject{{"name", "translations"}, {"strict", true}, {"schema", schema}}},
+    };
+}
+
+bool JsonLinesLog::open(const QString &path, const std::function<void(const QJsonObject &)> &onEntry,
+                        bool readOnly)
+{
+    m_file.setFileName(path);
+    bool endsWithNewline = true;
+    const bool readable = m_file.open(QIODevice::ReadOnly);
+    if (readable) {
+        while (!m_file.atEnd()) {
+            const QByteArray line = m_file.readLine();
+            endsWithNewline = line.endsWith('\n');
+            const QJsonDocument entry = QJsonDocument::fromJson(line.trimmed());
+            if (entry.isObject())
+                onEntry(entry.object());
+        }
+        m_file.close();
+    }
+    if (readOnly) {
+        if (!readable)
+            qWarning() << "Unable to read log:" << path;
+        return readable;
+    }
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Unable to open log for appending:" << path;
+        return false;
+    }
+    if (!endsWithNewline)
+        m_file.write("\n");
+    return true;
+}
+
+void JsonLinesLog::sync()
+{
+    m_file.flush();
+#ifdef Q_OS_WIN
+    _commit(m_file.handle());
+#else
+    fsync(m_file.handle());
+#endif
+}
+
+bool TranslationMemory::open(const QString &path, bool readOnly)
+{
+    const bool opened = m_log.open(path, [this](const QJsonObject &entry) {
+        const QString source = entry["s"].toString();
+        if (!source.isEmpty())
+            m_entries.insert(key(source, entry["l"].toString(), entry["m"].toString()),
+                             entry["t"].toString());
+    }, readOnly);
+    if (opened)
+        qDebug() << "Translation memory entries loaded:" << m_entries.size();
+    return opened;
+}
+
+bool TranslationMemory::lookup(const QString &source, const QString &lang, const QStringList &models,
+                               QString *translation)
+{
+    for (const QString &model : models) {
+        auto it = m_entries.constFind(key(source, lang, model));
+        if (it != m_entries.constEnd()) {
+            ++m_hits;
+            *translation = it.value();
+            return true;
+        }
+    }
+    ++m_misses;
+    return false;
+}
+
+void TranslationMemory::store(const QString &source, const QString &lang, const QString &model,
+                              const QString &translation)
+{
+    const QString entryKey = key(source, lang, model);
+    auto it = m_entries.find(entryKey);
+    if (it != m_entries.end() && it.value() == translation)
+        return;
+    m_entries.insert(entryKey, translation);
+    if (!m_log.isOpen())
+        return;
+
+    QJsonObject entry;
+    entry["s"] = source;
+    entry["l"] = lang;
+    entry["m"] = model;
+    entry["t"] = translation;
+    m_log.append(entry);
+}
+
+int CheckpointJournal::replay(QList<LanguageJob> &jobs)
+{
+    int applied = 0;
+    for (const Entry &entry : std::as_const(m_replay)) {
+        for (LanguageJob &job : jobs) {
+            if (job.target.lang == entry.lang && applyTranslation(job, entry.source, entry.translation))
+                ++applied;
+        }
+    }
+    m_replay.clear();
+    return applied;
+}
+
+void CheckpointJournal::record(const QString &lang, const QHash<QString, QString> &applied)
+{
+    if (!m_log.isOpen() || applied.isEmpty())
+        return;
+    for (auto it = applied.constBegin(); it != applied.constEnd(); ++it) {
+        QJsonObject entry;
+        entry["l"] = lang;
+        entry["s"] = it.key();
+        entry["t"] = it.value();
+        m_log.append(entry);
+    }
+    m_log.sync();
+}
+
+qint64 RateLimiter::delayFor(int tokens)
+{
+    refill();
+    qint64 delay = qMax<qint64>(0, m_blockedUntil - m_clock.elapsed());
+    if (m_requestsPerMinute > 0 && m_requests < 1.0)
+        delay = qMax(delay, qint64((1.0 - m_requests) * 60000.0 / m_requestsPerMinute) + 1);
+    if (m_tokensPerMinute > 0) {
+        const double needed = qMin<double>(tokens, m_tokensPerMinute);
+        if (m_tokens < needed)
+            delay = qMax(delay, qint64((needed - m_tokens) * 60000.0 / m_tokensPerMinute) + 1);
+    }
+    return delay;
+}
+
+void RateLimiter::consume(int tokens)
+{
+    refill();
+    if (m_requestsPerMinute > 0)
+        m_requests -= 1.0;
+    if (m_tokensPerMinute > 0)
+        m_tokens -= tokens;
+}
+
+void RateLimiter::updateBucket(const QNetworkReply *reply, const QByteArray &kind, int &perMinute, double &available)
+{
+    bool ok = false;
+    const int limit = reply->rawHeader("x-ratelimit-limit-" + kind).toInt(&ok);
+    if (ok && perMinute <= 0 && limit > 0) {
+        perMinute = limit;
+        available = limit;
+    }
+    const int remaining = reply->rawHeader("x-ratelimit-remaining-" + kind).toInt(&ok);
+    if (!ok)
+        return;
+    if (perMinute > 0)
+        available = qMin<double>(available, remaining);
+    if (remaining <= 0) {
+        const qint64 reset = parseResetDuration(reply->rawHeader("x-ratelimit-reset-" + kind));
+        if (reset > 0)
+            pause(reset);
+    }
+}
+
+void RateLimiter::refill()
+{
+    const qint64 now = m_clock.elapsed();
+    const double minutes = (now - m_lastRefill) / 60000.0;
+    m_lastRefill = now;
+    if (m_requestsPerMinute > 0)
+        m_requests = qMin<double>(m_requestsPerMinute, m_requests + minutes * m_requestsPerMinute);
+    if (m_tokensPerMinute > 0)
+        m_tokens = qMin<double>(m_tokensPerMinute, m_tokens + minutes * m_tokensPerMinute);
+}
+
+BatchScheduler::BatchScheduler(const Config &config, const QList<TranslationBackend *> &backends,
+                               TranslationMemory *memory, CheckpointJournal *journal)
+    : m_config(config)
+    , m_memory(memory)
+    , m_journal(journal)
+{
+    for (TranslationBackend *backend : backends) {
+        m_backends.append(BackendState(backend));
+        m_backends.last().batchSize = qMax(1, config.apiCallSize);
+        m_backends.last().concurrency = qMax(1, backend->config().maxConcurrentRequests);
+    }
+}
+
+void BatchScheduler::addBatch(const QStringList &phrases, LanguageJob *job)
+{
+    if (!phrases.isEmpty() && !m_backends.isEmpty()) {
+        m_backends.first().pending.enqueue({phrases, job, 0, 0, metrics().elapsedMs(), m_nextOrigin++});
+        m_plannedPhrases += phrases.size();
+    }
+}
+
+void BatchScheduler::run()
+{
+    QTimer progress;
+    if (m_config.progressIntervalMs > 0) {
+        QObject::connect(&progress, &QTimer::timeout, &progress, [this]() { reportProgress(); });
+        progress.start(m_config.progressIntervalMs);
+    }
+    dispatchPending();
+    if (!isDone())
+        m_eventLoop.exec();
+    if (m_droppedPhrases > 0)
+        qWarning() << "Gave up on" << m_droppedPhrases << "phrases after" << m_config.maxRetries << "retries.";
+}
+
+void BatchScheduler::reportProgress() const
+{
+    int inFlight = 0;
+    for (const BackendState &state : m_backends)
+        inFlight += state.inFlight;
+    qInfo().noquote() << QStringLiteral("Progress: %1/%2 phrases, %3 requests, %4 in flight, %5 s")
+                             .arg(m_appliedPhrases)
+                             .arg(m_plannedPhrases)
+                             .arg(metrics().requestCount())
+                             .arg(inFlight)
+                             .arg(metrics().elapsedMs() / 1000.0, 0, 'f', 1);
+}
+
+bool BatchScheduler::isDone() const
+{
+    if (m_waitingRetries > 0)
+        return false;
+    for (const BackendState &state : m_backends) {
+        if (state.inFlight > 0 || !state.pending.isEmpty() || state.dispatchTimerArmed)
+            return false;
+    }
+    return true;
+}
+
+void BatchScheduler::dispatchPending(int index)
+{
+    BackendState &state = m_backends[index];
+    const int limit = m_config.adaptiveBatching ? state.concurrency
+                                                : qMax(1, state.backend->config().maxConcurrentRequests);
+    while (state.inFlight < limit && !state.pending.isEmpty()) {
+        if (m_config.adaptiveBatching)
+            resizeHead(state);
+        const int tokens = estimateBatchTokens(state.pending.head().phrases);
+        const qint64 delay = state.rateLimiter.delayFor(tokens);
+        if (delay > 0) {
+            // Tied to the event loop, so the timer dies with the scheduler. run() waits for it.
+            if (!state.dispatchTimerArmed) {
+                state.dispatchTimerArmed = true;
+                QTimer::singleShot(static_cast<int>(delay), &m_eventLoop, [this, index]() {
+                    m_backends[index].dispatchTimerArmed = false;
+                    dispatchPending(index);
+                    if (isDone())
+                        m_eventLoop.quit();
+                });
+            }
+            return;
+        }
+        state.rateLimiter.consume(tokens);
+        metrics().addEstimatedTokens(tokens);
+
+        const PendingBatch batch = state.pending.dequeue();
+        QSharedPointer<RequestTrace> trace(new RequestTrace{metrics().elapsedMs()});
+        QNetworkReply *reply = state.backend->sendTranslationBatch(batch.phrases, batch.job->target.lang,
+                                                                   batch.job->target.langPostfix);
+        ++state.inFlight;
+        QSharedPointer<StreamedResponse> stream(state.backend->createStream(*batch.job, batch.phrases));
+        QObject::connect(reply, &QNetworkReply::metaDataChanged, reply, [trace]() {
+            if (trace->firstByteAt < 0)
+                trace->firstByteAt = metrics().elapsedMs();
+        });
+        if (stream) {
+            QObject::connect(reply, &QNetworkReply::readyRead, reply,
+                             [reply, stream]() { stream->feed(reply->readAll()); });
+        }
+        QObject::connect(reply, &QNetworkReply::finished, reply, [this, reply, batch, stream, trace]() {
+            handleReply(reply, batch, stream.data(), *trace);
+        });
+    }
+}
+
+void BatchScheduler::handleReply(QNetworkReply *reply, const PendingBatch &batch, StreamedResponse *stream,
+                                 const RequestTrace &trace)
+{
+    BackendState &state = m_backends[batch.backend];
+    --state.inFlight;
+    state.rateLimiter.update(reply);
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const bool failed = reply->error() != QNetworkReply::NoError;
+
+    // A streamed reply keeps what it applied before failing.
+    QHash<QString, QString> applied;
+    if (stream) {
+        stream->feed(reply->readAll());
+        applied = stream->applied();
+    } else if (!failed) {
+        applied = state.backend->processResponse(reply->readAll(), *batch.job, batch.phrases);
+    }
+    if (m_memory && !applied.isEmpty()) {
+        for (auto it = applied.constBegin(); it != applied.constEnd(); ++it)
+            m_memory->store(it.key(), batch.job->target.lang, state.backend->config().model, it.value());
+        m_memory->flush();
+    }
+    if (m_journal)
+        m_journal->record(batch.job->target.lang, applied);
+    m_appliedPhrases += applied.size();
+    metrics().addAppliedPhrases(applied.size());
+    metrics().addRequest(state.backend->config().name, batch.phrases.size(), trace.sentAt - batch.queuedAt,
+                         trace.firstByteAt < 0 ? -1 : trace.firstByteAt - trace.sentAt,
+                         metrics().elapsedMs() - trace.sentAt, failed);
+
+    QStringList missing;
+    for (const QString &phrase : batch.phrases) {
+        if (!applied.contains(phrase))
+            missing.append(phrase);
+    }
+    if (!failed && !applied.isEmpty() && !missing.isEmpty())
+        qDebug() << "Response left out" << missing.size() << "of" << batch.phrases.size() << "phrases.";
+    if (m_config.adaptiveBatching)
+        adapt(state, batch, int(applied.size()), failed, status, metrics().elapsedMs() - trace.sentAt);
+
+    if (failed) {
+        qWarning() << "Network error:" << state.backend->config().name << reply->errorString();
+        if (isTransientFailure(reply->error(), status)) {
+            qint64 delay = retryAfterMs(reply);
+            if (status == 429) {
+                if (delay < 0)
+                    delay = backoffDelay(batch.attempt);
+                state.rateLimiter.pause(delay);
+            }
+            retry(missing, batch, delay);
+        } else {
+            fallBack(missing, batch);
+        }
+    } else if (applied.isEmpty() && batch.phrases.size() > 1) {
+        // Nothing usable came back; smaller batches are less likely to be truncated.
+        const int half = batch.phrases.size() / 2;
+        retry(batch.phrases.mid(0, half), batch, 0);
+        retry(batch.phrases.mid(half), batch, 0);
+    } else {
+        retry(missing, batch, 0);
+    }
+    reply->deleteLater();
+
+    dispatchPending();
+    if (isDone())
+        m_eventLoop.quit();
+}
+
+void BatchScheduler::resizeHead(BackendState &state)
+{
+    PendingBatch &head = state.pending.head();
+    if (head.phrases.size() > state.batchSize) {
+        PendingBatch rest = head;
+        rest.phrases = head.phrases.mid(state.batchSize);
+        head.phrases.resize(state.batchSize);
+        state.pending.insert(1, rest);
+        return;
+    }
+
+    const int overhead = estimateBatchTokens(QStringList());
+    int tokens = estimateBatchTokens(head.phrases);
+    for (int i = 1; i < state.pending.size() && head.phrases.size() < state.batchSize;) {
+        PendingBatch &other = state.pending[i];
+        if (other.job != head.job) {
+            ++i;
+            continue;
+        }
+        if (other.origin != head.origin) {
+            const int otherTokens = estimateBatchTokens(other.phrases) - overhead;
+            if (head.phrases.size() + other.phrases.size() > state.batchSize
+                || (m_config.maxTokensPerRequest > 0 && tokens + otherTokens > m_config.maxTokensPerRequest))
+                return;
+            tokens += otherTokens;
+            head.phrases += other.phrases;
+            head.attempt = qMax(head.attempt, other.attempt);
+            state.pending.removeAt(i);
+            continue;
+        }
+        while (!other.phrases.isEmpty() && head.phrases.size() < state.batchSize) {
+            const int phraseTokens = estimateBatchTokens({other.phrases.first()}) - overhead;
+            if (m_config.maxTokensPerRequest > 0 && tokens + phraseTokens > m_config.maxTokensPerRequest)
+                return;
+            tokens += phraseTokens;
+            head.phrases.append(other.phrases.takeFirst());
+            head.attempt = qMax(head.attempt, other.attempt);
+        }
+        if (other.phrases.isEmpty())
+            state.pending.removeAt(i);
+    }
+}
+
+void BatchScheduler::adapt(BackendState &state, const PendingBatch &batch, int appliedCount, bool failed, int status,
+                           qint64 latencyMs)
+{
+    const int sent = int(batch.phrases.size());
+    const int maxBatchSize = qMax(1, m_config.adaptiveMaxBatchSize);
+    // Shrinking never goes below the configured size when that is already small.
+    const int minBatchSize = qMin(kAdaptiveMinBatchSize, qMax(1, m_config.apiCallSize));
+    const int maxConcurrency = qMax(1, state.backend->config().maxConcurrentRequests);
+    const double missingFraction = sent > 0 ? 1.0 - double(appliedCount) / sent : 0.0;
+    const double seconds = qMax<qint64>(1, latencyMs) / 1000.0;
+    const double tokensPerSecond = estimateCompletionTokens(batch.phrases) * (1.0 - missingFraction) / seconds;
+    const double phrasesPerSecond = appliedCount / seconds;
+    const int oldBatchSize = state.batchSize;
+    const int oldConcurrency = state.concurrency;
+    QString reason;
+
+    if (failed && (status == 429 || status >= 500)) {
+        state.concurrency = qMax(1, state.concurrency / 2);
+        state.goodReplies = 0;
+        reason = status == 429 ? QStringLiteral("rate limited") : QStringLiteral("server error");
+    } else if (failed) {
+        state.batchSize = qMax(minBatchSize, qMin(state.batchSize, sent) / 2);
+        state.goodReplies = 0;
+        reason = QStringLiteral("request failed");
+    } else if (missingFraction > kAdaptiveMaxMissingFraction) {
+        state.batchSize = qMax(minBatchSize, qMin(state.batchSize, sent) / 2);
+        state.goodReplies = 0;
+        reason = QStringLiteral("incomplete answer");
+    } else {
+        // Only full batches tell whether a larger size still pays off.
+        const bool keepsUp = state.phrasesPerSecond <= 0 || phrasesPerSecond >= 0.9 * state.phrasesPerSecond;
+        if (sent >= state.batchSize && keepsUp && state.batchSize < maxBatchSize) {
+            state.batchSize = qMin(maxBatchSize, state.batchSize + kAdaptiveBatchStep);
+            reason = QStringLiteral("larger batches keep up");
+        }
+        if (++state.goodReplies >= state.concurrency && state.concurrency < maxConcurrency) {
+            ++state.concurrency;
+            state.goodReplies = 0;
+            reason = reason.isEmpty() ? QStringLiteral("replies pass the quality gate")
+                                      : reason + QStringLiteral(", replies pass the quality gate");
+        }
+        state.phrasesPerSecond = state.phrasesPerSecond <= 0 ? phrasesPerSecond
+                                                             : 0.8 * state.phrasesPerSecond + 0.2 * phrasesPerSecond;
+    }
+
+    if (state.batchSize != oldBatchSize || state.concurrency != oldConcurrency) {
+        qDebug() << "Adaptive batching:" << state.backend->config().name << "batch size" << state.batchSize
+                 << "concurrency" << state.concurrency << "-" << reason;
+        metrics().addAdaptiveDecision(state.backend->config().name, state.batchSize, state.concurrency, reason,
+                                      latencyMs, tokensPerSecond, missingFraction);
+    }
+}
+
+void BatchScheduler::retry(const QStringList &phrases, const PendingBatch &batch, qint64 delay)
+{
+    if (phrases.isEmpty())
+        return;
+    if (batch.attempt >= m_config.maxRetries) {
+        fallBack(phrases, batch);
+        return;
+    }
+    if (delay < 0)
+        delay = backoffDelay(batch.attempt);
+    ++m_waitingRetries;
+    metrics().countRetry();
+    PendingBatch next{phrases, batch.job, batch.backend, batch.attempt + 1, 0, batch.origin};
+    QTimer::singleShot(static_cast<int>(delay), &m_eventLoop, [this, next]() mutable {
+        --m_waitingRetries;
+        next.queuedAt = metrics().elapsedMs();
+        m_backends[next.backend].pending.prepend(next);
+        dispatchPending(next.backend);
+    });
+}
+
+void BatchScheduler::fallBack(const QStringList &phrases, const PendingBatch &batch)
+{
+    if (phrases.isEmpty())
+        return;
+    const int next = batch.backend + 1;
+    if (next >= m_backends.size()) {
+        m_droppedPhrases += phrases.size();
+        metrics().addDroppedPhrases(phrases.size());
+        return;
+    }
+    qWarning() << "Falling back to" << m_backends.at(next).backend->config().name << "for" << phrases.size()
+               << "phrases.";
+    metrics().countFallback();
+    m_backends[next].pending.enqueue({phrases, batch.job, next, 0, metrics().elapsedMs(), batch.origin});
+}
+
+bool BatchScheduler::isTransientFailure(QNetworkReply::NetworkError error, int status)
+{
+    if (status == 408 || status == 409 || status == 429 || status >= 500)
+        return true;
+    // Connection, timeout and proxy level errors; TLS failures will not fix themselves.
+    return status == 0 && error < QNetworkReply::ContentAccessDenied
+           && error != QNetworkReply::SslHandshakeFailedError;
+}
+
+TsFileWatcher::TsFileWatcher(const QStringList &paths, const std::function<void(const QStringList &)> &onChanged,
+                             int settleMs)
+    : m_paths(paths)
+    , m_onChanged(onChanged)
+{
+    m_watcher.addPaths(paths);
+    m_settle.setSingleShot(true);
+    m_settle.setInterval(settleMs);
+    QObject::connect(&m_watcher, &QFileSystemWatcher::fileChanged, &m_settle, [this](const QString &path) {
+        m_changed.insert(path);
+        m_settle.start();
+    });
+    QObject::connect(&m_settle, &QTimer::timeout, &m_settle, [this]() { report(); });
+}
+
+void TsFileWatcher::report()
+{
+    if (m_busy) {
+        m_settle.start();
+        return;
+    }
+
+    QStringList changed;
+    const QStringList watched = m_watcher.files();
+    for (const QString &path : std::as_const(m_paths)) {
+        if (!m_changed.contains(path))
+            continue;
+        if (!QFileInfo::exists(path)) {
+            // Still being replaced; look again later.
+            m_settle.start();
+            continue;
+        }
+        if (!watched.contains(path))
+            m_watcher.addPath(path);
+        m_changed.remove(path);
+        changed.append(path);
+    }
+    if (changed.isEmpty())
+        return;
+
+    m_busy = true;
+    m_onChanged(changed);
+    m_busy = false;
+}
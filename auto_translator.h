@@ -0,0 +1,1432 @@
+#ifndef AUTO_TRANSLATOR_H
+#define AUTO_TRANSLATOR_H
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDir>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QRegularExpression>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkRequest>
+#include <QtNetwork/QNetworkReply>
+#include <QSslConfiguration>
+#include <QUrl>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QEventLoop>
+#include <QQueue>
+#include <QTextStream>
+#include <QStringEncoder>
+#include <QThread>
+#include <QPair>
+#include <QMultiHash>
+#include <QReadWriteLock>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QTimer>
+#include <QFileSystemWatcher>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QRandomGenerator>
+#include <QSharedPointer>
+#include <utility>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/// @brief Table of interned strings addressed by a compact numeric ID.
+/// @details TS files repeat the same handful of location filenames on every message. Each
+/// distinct string is stored once and referenced by its index. Interning an already known
+/// string does not allocate, and the table may be used from several threads.
+class StringTable
+{
+public:
+    /// @brief Returns the ID of a string, adding it to the table if it is new.
+    quint32 intern(QStringView text);
+
+    /// @brief Returns the string with the given ID.
+    QString at(quint32 id) const
+    {
+        QReadLocker locker(&m_lock);
+        return m_strings.value(id);
+    }
+
+private:
+    static constexpr quint32 kNotFound = 0xFFFFFFFFu;
+
+    quint32 find(QStringView text, size_t hash) const;
+
+    mutable QReadWriteLock m_lock;
+    QList<QString> m_strings;
+    QMultiHash<size_t, quint32> m_ids;
+};
+
+/// @brief The table all location filenames are interned in.
+StringTable &locationFileNames();
+
+#ifdef QT_AUTO_TRANSLATION_ALLOC_COUNTERS
+constexpr bool kAllocationCounters = true;
+#else
+constexpr bool kAllocationCounters = false;
+#endif
+
+/// @brief Heap allocations made by one thread.
+struct AllocationCount {
+    quint64 count = 0; ///< Number of allocations, reallocations included.
+    quint64 bytes = 0; ///< Bytes requested by them.
+};
+
+/// @brief The allocations the calling thread has made so far.
+/// @details Only counted in builds with the QT_AUTO_TRANSLATION_ALLOC_COUNTERS option, which
+/// replaces malloc() on glibc and operator new elsewhere. Always zero otherwise.
+AllocationCount threadAllocations();
+
+/// @brief Timings and counters of a run, written as a JSON report at exit.
+/// @details Stages are timed with StageTimer, every finished HTTP request is recorded with
+/// its queue wait, time to first byte and total time, and the scheduler counts retries,
+/// fallbacks and applied phrases. The report separates CPU bound stages from the network
+/// stage, so a slow run can be attributed. All members may be called from several threads.
+class Metrics
+{
+public:
+    Metrics()
+    {
+        m_clock.start();
+    }
+
+    /// @brief Milliseconds since the metrics were created, the common clock of all records.
+    qint64 elapsedMs() const { return m_clock.elapsed(); }
+
+    /// @brief Adds one run of a stage.
+    /// @param allocations The heap allocations the run made, see threadAllocations().
+    void addStage(const QString &name, qint64 nsecs, const AllocationCount &allocations = {});
+
+    /// @brief Adds a finished request.
+    /// @param ttfbMs The time from sending to the first response bytes, -1 if none arrived.
+    void addRequest(const QString &backend, int phrases, qint64 queueWaitMs, qint64 ttfbMs, qint64 totalMs,
+                    bool failed)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_requests.append({backend, phrases, queueWaitMs, ttfbMs, totalMs, failed});
+    }
+
+    /// @brief Adds the token usage reported by the API for one request.
+    void addUsage(const QJsonObject &usage);
+
+    void addEstimatedTokens(int tokens)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_estimatedTokens += tokens;
+    }
+
+    void addAppliedPhrases(int phrases)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_appliedPhrases += phrases;
+    }
+
+    void countRetry()
+    {
+        QMutexLocker locker(&m_mutex);
+        ++m_retries;
+    }
+
+    void countFallback()
+    {
+        QMutexLocker locker(&m_mutex);
+        ++m_fallbacks;
+    }
+
+    void addDroppedPhrases(int phrases)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_droppedPhrases += phrases;
+    }
+
+    void setCache(int hits, int misses)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_cacheHits = hits;
+        m_cacheMisses = misses;
+    }
+
+    void setMessagesTranslated(int messages)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_messagesTranslated = messages;
+    }
+
+    /// @brief Records a change of the adaptive batch size or concurrency of a backend.
+    /// @param latencyMs The duration of the request that led to the change.
+    /// @param tokensPerSecond The completion tokens per second of that request, estimated.
+    /// @param missingFraction The share of its phrases the request did not translate.
+    void addAdaptiveDecision(const QString &backend, int batchSize, int concurrency, const QString &reason,
+                             qint64 latencyMs, double tokensPerSecond, double missingFraction);
+
+    int appliedPhrases() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_appliedPhrases;
+    }
+
+    int requestCount() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return int(m_requests.size());
+    }
+
+    /// @brief The report of everything recorded so far.
+    QJsonObject toJson() const;
+
+    /// @brief Writes the report to a file, replacing it atomically.
+    bool writeReport(const QString &path) const;
+
+private:
+    struct Stage {
+        int count = 0;
+        qint64 totalNs = 0;
+        qint64 maxNs = 0;
+        quint64 allocations = 0;
+        quint64 allocatedBytes = 0;
+    };
+
+    struct Request {
+        QString backend;
+        int phrases;
+        qint64 queueWaitMs;
+        qint64 ttfbMs;
+        qint64 totalMs;
+        bool failed;
+    };
+
+    /// @brief Average, median, 95th percentile and maximum of a list of durations.
+    static QJsonObject distribution(QList<qint64> values);
+
+    mutable QMutex m_mutex;
+    QElapsedTimer m_clock;
+    QHash<QString, Stage> m_stages;
+    QStringList m_stageOrder;
+    QList<Request> m_requests;
+    qint64 m_estimatedTokens = 0;
+    qint64 m_promptTokens = 0;
+    qint64 m_cachedPromptTokens = 0;
+    qint64 m_completionTokens = 0;
+    int m_appliedPhrases = 0;
+    int m_retries = 0;
+    int m_fallbacks = 0;
+    int m_droppedPhrases = 0;
+    int m_cacheHits = 0;
+    int m_cacheMisses = 0;
+    int m_messagesTranslated = 0;
+    QJsonArray m_adaptiveDecisions;
+};
+
+/// @brief The metrics of the current run.
+Metrics &metrics();
+
+/// @brief Adds the time between its construction and destruction to a stage of metrics().
+/// @details With allocation counters, the allocations the thread made meanwhile are added too,
+/// so the timer must be destroyed on the thread that created it.
+class StageTimer
+{
+public:
+    explicit StageTimer(const QString &stage)
+        : m_stage(stage)
+        , m_allocations(threadAllocations())
+    {
+        m_timer.start();
+    }
+    ~StageTimer()
+    {
+        const qint64 nsecs = m_timer.nsecsElapsed();
+        const AllocationCount now = threadAllocations();
+        metrics().addStage(m_stage, nsecs, {now.count - m_allocations.count, now.bytes - m_allocations.bytes});
+    }
+
+private:
+    QString m_stage;
+    AllocationCount m_allocations;
+    QElapsedTimer m_timer;
+};
+
+/// @brief Size and modification time of a file, to tell whether it changed since it was read.
+struct FileStamp {
+    qint64 size = -1;       ///< Size in bytes, -1 if the file did not exist.
+    qint64 modifiedMs = -1; ///< Modification time in ms since the epoch.
+
+    /// @brief The stamp of a file as it is now.
+    static FileStamp of(const QString &path);
+
+    bool operator==(const FileStamp &other) const { return size == other.size && modifiedMs == other.modifiedMs; }
+    bool operator!=(const FileStamp &other) const { return !(*this == other); }
+};
+
+/// @brief Represents a source code location.
+/// @details This structure stores the filename and line number where a particular event occurs.
+/// The filename is kept as an ID into locationFileNames(), so a location is two integers.
+struct Location {
+    quint32 fileId; ///< The ID of the file where the location is referenced.
+    int line; ///< The line number within the file.
+
+    /// @brief The name of the file where the location is referenced.
+    QString filename() const { return locationFileNames().at(fileId); }
+};
+
+/// @brief Holds information about a translation message.
+/// @details This structure contains details about a message, including its source text,
+/// translation and type. Its context and locations are ranges into the owning Catalog.
+struct MessageInfo {
+    QString source; ///< The original text of the message.
+    QString translation; ///< The translated text.
+    QString translationType; ///< The type of translation, e.g., "unfinished".
+    QString originalTranslation; ///< The translation as it was parsed, to detect changes.
+    QString originalType; ///< The translation type as it was parsed, to detect changes.
+    int ordinal = -1; ///< Position of the message among all messages of the parsed file.
+    int context = -1; ///< Index of the message's context in Catalog::contexts().
+    int firstLocation = 0; ///< Index of the message's first location in the Catalog.
+    int locationCount = 0; ///< Number of locations of the message.
+    bool pending = false; ///< Picked by selectMessages() and not translated since.
+    bool locationsModified = false; ///< The locations differ from the parsed file, see Catalog::setLocations().
+
+    /// @brief Tells whether the translation or its type differs from the parsed file.
+    bool isModified() const { return translation != originalTranslation || translationType != originalType; }
+};
+
+/// @brief A context of a Catalog: its name and the range of its messages.
+struct ContextInfo {
+    QString name;     ///< The context name.
+    int firstMessage; ///< ID of the first message of the context.
+    int messageCount; ///< Number of messages in the context.
+};
+
+/// @brief A contiguous run of locations of one message.
+struct LocationRange {
+    const Location *first;
+    const Location *last;
+
+    const Location *begin() const { return first; }
+    const Location *end() const { return last; }
+    int size() const { return int(last - first); }
+};
+
+/// @brief Flat, cache friendly store of the messages of a TS file.
+/// @details All messages live in one contiguous list in document order, and their index in it
+/// is a stable message ID. Contexts are ranges of that list, in document order and with
+/// duplicate names kept. Locations of all messages share one flat list as well. Full-catalog
+/// passes are therefore linear scans over contiguous memory. Copies share their data until
+/// one of them is modified.
+class Catalog
+{
+public:
+    /// @brief Starts a new context; messages added afterwards belong to it.
+    void addContext(const QString &name)
+    {
+        m_contexts.append({name, int(m_messages.size()), 0});
+    }
+
+    /// @brief Appends a message with its locations to the last context.
+    /// @return The ID of the new message.
+    int addMessage(MessageInfo msg, const QList<Location> &locations);
+
+    int messageCount() const { return int(m_messages.size()); }
+    MessageInfo &message(int id) { return m_messages[id]; }
+    const MessageInfo &message(int id) const { return m_messages.at(id); }
+    QList<MessageInfo> &messages() { return m_messages; }
+    const QList<MessageInfo> &messages() const { return m_messages; }
+    const QList<ContextInfo> &contexts() const { return m_contexts; }
+
+    /// @brief The name of the context of a message.
+    const QString &contextName(const MessageInfo &msg) const { return m_contexts.at(msg.context).name; }
+
+    /// @brief The locations of a message.
+    LocationRange locations(const MessageInfo &msg) const
+    {
+        const Location *first = m_locations.constData() + msg.firstLocation;
+        return {first, first + msg.locationCount};
+    }
+
+    /// @brief Replaces the locations of a message.
+    /// @details The same number of locations is overwritten in place. Otherwise the new ones
+    /// are appended to the flat list, and once the ranges left unused outweigh the ones in use
+    /// the list is compacted, so repeated imports do not grow it. Locations that differ from
+    /// the current ones mark the message's MessageInfo::locationsModified.
+    void setLocations(int id, const QList<Location> &locations);
+
+    /// @brief The stamp of the file the catalog was read from, at the time it was read.
+    const FileStamp &sourceStamp() const { return m_sourceStamp; }
+    void setSourceStamp(const FileStamp &stamp) { m_sourceStamp = stamp; }
+
+    /// @brief Appends the contexts, messages and locations of another catalog.
+    /// @details Merges catalogs parsed from consecutive parts of one file. Contexts are kept
+    /// as they are, including duplicate names. The source index has to be built afterwards.
+    ///
+    /// @param other The catalog to append.
+    /// @param ordinalOffset Added to the ordinals of the appended messages.
+    void append(const Catalog &other, int ordinalOffset);
+
+    /// @brief Builds the index from source text to message IDs used by messagesWithSource().
+    /// @details Called once after parsing so that responses can be applied by lookup instead
+    /// of scanning every message. Copies made afterwards share the index.
+    void buildSourceIndex();
+
+    /// @brief The IDs of all messages with the given source text, across all contexts.
+    const QList<int> &messagesWithSource(const QString &source) const
+    {
+        static const QList<int> none;
+        auto it = m_sourceIndex.constFind(source);
+        return it == m_sourceIndex.constEnd() ? none : it.value();
+    }
+
+private:
+    /// @brief Rewrites the flat location list with only the ranges in use, in message order.
+    void compactLocations();
+
+    QList<MessageInfo> m_messages;
+    QList<ContextInfo> m_contexts;
+    QList<Location> m_locations;
+    int m_unusedLocations = 0; ///< Locations no message refers to any more.
+    QHash<QString, QList<int>> m_sourceIndex;
+    FileStamp m_sourceStamp;
+};
+
+/// @brief One target language of a translation run.
+struct TranslationTarget {
+    QString lang;          ///< Target language for translation.
+    QString langPostfix;   ///< Additional language specification (e.g., TR_tr, RU_ru).
+    QString tsFilePath;    ///< The TS file the translations of this language are written to.
+    QString csvToImport;   ///< The CSV file imported into this language in importFromCSV mode.
+    QString csvToExport;   ///< The CSV file this language is exported to in exportToCSV mode.
+};
+
+/// @brief One translation service of a run, see TranslationBackend.
+struct BackendConfig {
+    QString name;              ///< Name used in log output.
+    QString endpoint;          ///< URL of the chat completions endpoint.
+    QString model;             ///< The model requested from the endpoint.
+    QString apiKeyPath;        ///< Path to the API key file. No key is sent if empty.
+    int maxConcurrentRequests; ///< Maximum number of requests kept in flight at this backend.
+    int requestsPerMinute;     ///< Requests per minute allowed by the backend. 0 means unlimited.
+    int tokensPerMinute;       ///< Tokens per minute allowed by the backend. 0 means unlimited.
+    int requestTimeoutMs;      ///< A request that transfers nothing for this long is aborted and retried. 0 disables it.
+    bool http2;                ///< If true requests may be multiplexed over HTTP/2.
+    bool stream;               ///< If true responses are streamed and applied entry by entry as they arrive.
+    bool structuredOutput;     ///< If true phrases are sent with IDs and answered under a JSON schema.
+    double inputCostPerMillion;  ///< Price of one million prompt tokens, used by --plan.
+    double outputCostPerMillion; ///< Price of one million completion tokens, used by --plan.
+};
+
+/// @brief Holds configuration settings for the translation process.
+/// @details This structure stores file paths, API settings, and language options.
+///
+/// mmapTs and parallelParse, which maps the file as well, are off by default: a TS file that
+/// another tool truncates while it is mapped, as lupdate can do to a file a --watch run is
+/// reading, ends the process with SIGBUS instead of failing the parse.
+struct Config {
+    QString tsFilePath;    ///< Path to the TS (translation source) file.
+    QString apiKeyPath;    ///< Path to the API key file.
+    int apiCallSize;       ///< Maximum number of phrases per API call batch.
+    int maxTokensPerRequest; ///< Estimated prompt plus completion token budget per API call. 0 disables it.
+    QString lang;          ///< Target language for translation.
+    QString langPostfix;   ///< Additional language specification (e.g., TR_tr, RU_ru).
+    QString csvToImport;   ///< If the importFromCSV option is true this file will be imported and written into ts file.
+    QString csvToExport;   ///< If the exportToCSV option is true this file will be written with the original source and translations.
+    bool importFromCSV;    ///< If true the program will read from csv and write into ts. Won't make GPT calls.
+    bool exportToCSV;      ///< If true translations will write into csv file.
+    bool writeBackToTs;    ///< If true the TS file will be overwritten and the translations will be put into place.
+    int maxConcurrentRequests; ///< Maximum number of translation requests kept in flight at the same time.
+    bool http2;            ///< If true requests to the API may be multiplexed over HTTP/2.
+    QString model;         ///< The GPT model used for translation.
+    QString translationMemoryPath; ///< Path of the persistent translation memory log. Disabled if empty.
+    int requestsPerMinute; ///< Requests per minute allowed by the API account. 0 means unlimited.
+    int tokensPerMinute;   ///< Tokens per minute allowed by the API account. 0 means unlimited.
+    int maxRetries;        ///< How many times a failed batch or phrase is sent again.
+    int requestTimeoutMs;  ///< A request that transfers nothing for this long is aborted and retried. 0 disables it.
+    bool stream;           ///< If true responses are streamed and applied entry by entry as they arrive.
+    bool structuredOutput; ///< If true phrases are sent with IDs and answered under a JSON schema, see ChatCompletionsBackend.
+    QList<TranslationTarget> targets; ///< Languages translated in this run. Built from lang/langPostfix if "targets" is absent.
+    QString checkpointPath; ///< Path of the journal an interrupted run resumes from. Disabled if empty.
+    bool mmapTs;           ///< If true the TS file is memory-mapped for parsing instead of streamed.
+    bool parallelParse;    ///< If true large TS files are parsed on all cores, see TsReadMode::Parallel.
+    bool incrementalWrite; ///< If true only changed translations are spliced into the original TS file.
+    QString endpoint;      ///< URL of the chat completions endpoint, e.g. a local mock server for benchmarks.
+    QList<BackendConfig> backends; ///< Backends in fallback order. Built from the top-level settings if "backends" is absent.
+    QString metricsReportPath; ///< Path the JSON run report is written to at exit. Disabled if empty.
+    QStringList translateTypes; ///< Translation types that are (re)translated, see selectMessages().
+    QStringList contextPriority; ///< Wildcards of the context names translated first, in order.
+    QString glossaryPath;  ///< Path of the JSON glossary of fixed term translations. Disabled if empty.
+    double inputCostPerMillion;  ///< Price of one million prompt tokens, used by --plan.
+    double outputCostPerMillion; ///< Price of one million completion tokens, used by --plan.
+    int planTokensPerSecond; ///< Completion tokens per second assumed by --plan for one request.
+    bool exportChangedOnly; ///< If true the CSV export only lists messages changed by this run.
+    bool adaptiveBatching; ///< If true the scheduler adapts batch size and concurrency to the replies, see BatchScheduler.
+    int adaptiveMaxBatchSize; ///< Largest batch adaptive batching may grow to.
+    QString snapshotDir;   ///< Directory of the catalog snapshots runs reload instead of parsing. Disabled if empty.
+    int progressIntervalMs; ///< Interval of the live progress output while translating. 0 disables it.
+};
+
+/// @brief One TS file of a target language and the files its results go to.
+struct TsFileJob {
+    QString sourcePath;  ///< The TS file the catalog was parsed from.
+    QString tsFilePath;  ///< The TS file the translations are written to.
+    QString csvToImport; ///< The CSV file translations are imported from.
+    QString csvToExport; ///< The CSV file translations are exported to.
+    QString snapshotPath; ///< The catalog snapshot reloaded by the next run. Disabled if empty.
+    Catalog catalog;
+};
+
+/// @brief The TS files of one target language.
+/// @details Every language starts from copies of the same parsed catalogs. Batches are built
+/// per language over all of its files, so a source shared by several files is sent once and
+/// its translation is applied to each of them.
+struct LanguageJob {
+    TranslationTarget target;
+    QList<TsFileJob> files;
+};
+
+/// @brief How parseTsFile() reads the file.
+enum class TsReadMode {
+    Stream,  ///< Read through QFile in buffered chunks.
+    Mapped,  ///< Memory-map the file and parse the mapping without copying it.
+    Parallel ///< Memory-map the file and parse chunks of whole contexts on all cores.
+};
+
+/// @brief Parses a TS (Translation Source) file and extracts message information.
+/// @details This function reads an XML-based TS file into a Catalog of its contexts and messages.
+/// Each message includes source text, translation, translation type, and location data. The
+/// catalog's source stamp is taken before the file is read.
+///
+/// In Parallel mode the file is split at <context> tags into chunks of about equal size,
+/// which are parsed concurrently and appended to one catalog in document order. Small files
+/// are parsed in one piece, and a file whose chunks do not parse on their own is parsed
+/// again as a whole, so the result is always that of a sequential parse.
+///
+/// @param filePath The path to the TS file to be parsed.
+/// @param mode Whether the file is streamed, memory-mapped, or mapped and parsed in parallel.
+///             Streaming is the fallback if the file cannot be mapped.
+/// @return The catalog of the file's messages.
+Catalog parseTsFile(const QString &filePath, TsReadMode mode = TsReadMode::Stream);
+
+/// @brief Writes updated translations to a TS (Translation Source) file.
+/// @details This function takes a catalog and writes it into an XML-based TS file. It preserves
+/// structure, including context names and order, message sources, translations, and locations.
+///
+/// @param filePath The path to the TS file to be written.
+/// @param catalog The catalog to write.
+/// @return True if the file was successfully written, false otherwise.
+bool writeTsFile(const QString &filePath, const Catalog &catalog);
+
+/// @brief Writes translations by splicing only the changed <translation> elements into the
+/// original TS file.
+/// @details Everything else, including context order, attributes and formatting, is copied
+/// byte for byte from the parsed file, so an updated TS file differs from the original only in
+/// the messages that were translated. The whole file is rewritten with writeTsFile() instead
+/// if the source file changed since the catalog was parsed (its stamp differs from
+/// Catalog::sourceStamp()), if its messages or the source text of a changed one do not match
+/// the catalog, or if locations of a message were replaced, as only translations are spliced.
+/// Nothing is written when the output is the source file and no message changed.
+///
+/// @param sourcePath The TS file the translations were parsed from.
+/// @param filePath The path to the TS file to be written. May be the source file.
+/// @param catalog The catalog parsed from @p sourcePath.
+/// @return True if the file was successfully written, false otherwise.
+bool writeTsFileIncremental(const QString &sourcePath, const QString &filePath, const Catalog &catalog);
+
+/// @brief Exports all messages to a CSV file for review.
+/// @details Writes one row per message with its source, translation, translation type,
+/// locations ("filename:line" separated by semicolons) and context. importFromCsv() reads
+/// this format back. Large catalogs are formatted in parallel, in shards of whole contexts,
+/// straight into UTF-8 buffers.
+///
+/// @param csvFilePath The path of the CSV file to write.
+/// @param catalog The catalog to export.
+/// @param changedOnly If true only messages whose translation or type changed are exported.
+/// @return True if the file was successfully written, false otherwise.
+bool exportToCsv(const QString &csvFilePath, const Catalog &catalog, bool changedOnly = false);
+
+/// @brief Imports translations from a CSV file and updates the catalog.
+/// @details This function reads a CSV file containing translation data and updates
+/// the messages of the provided catalog. The CSV format is expected to have at least
+/// four columns: source text, translation, translation type, and locations.
+/// Locations are expected in the format "filename:line", separated by semicolons.
+/// If the header names a "context" column (as written by exportToCsv()), a row only updates
+/// the messages with that source in that context, narrowed down by the first location when
+/// the context holds the source several times. Otherwise every message with the source is
+/// updated.
+///
+/// The file is memory-mapped and read with CsvReader, so quoted fields spanning several lines
+/// are handled; large files are parsed in parallel. The messages are hashed once up front,
+/// so the import runs in time linear in the number of rows and messages.
+///
+/// @param csvFilePath The path to the CSV file to import.
+/// @param catalog The catalog whose translation fields are updated. Its source index must
+///                have been built.
+/// @return True if the CSV file was successfully read and processed, false otherwise.
+bool importFromCsv(const QString &csvFilePath, Catalog &catalog);
+
+/// @brief Reads all records of a UTF-8 CSV buffer as importFromCsv() does.
+/// @param data The CSV bytes, including the header.
+/// @param size The number of bytes.
+/// @param chunkCount The number of chunks to parse concurrently. 0 picks it from the size of
+///                   the buffer, 1 reads it sequentially. Every count gives the same records.
+/// @return The records in file order.
+QList<QStringList> readCsvRecords(const char *data, qsizetype size, int chunkCount = 0);
+
+/// @brief Writes a binary snapshot of a catalog, for runs that continue where this one stopped.
+/// @details The snapshot holds a table of all distinct strings of the catalog followed by
+/// fixed size context, message and location records that refer to them by index, including
+/// the translation state of every message. It also records the size and modification time
+/// of the TS file the catalog was read from, so a snapshot of an outdated file is not used.
+/// The file is replaced atomically.
+///
+/// @param snapshotPath The path of the snapshot file.
+/// @param catalog The catalog to store.
+/// @param sourcePath The TS file the catalog was parsed from.
+/// @return True if the snapshot was written.
+bool writeCatalogSnapshot(const QString &snapshotPath, const Catalog &catalog, const QString &sourcePath);
+
+/// @brief Loads a snapshot written by writeCatalogSnapshot().
+/// @details The file is memory-mapped and its records are copied into the catalog without
+/// any parsing. Snapshots of another format version are rejected.
+///
+/// @param snapshotPath The path of the snapshot file.
+/// @param catalog Receives the catalog. Its source index still has to be built.
+/// @param sourcePath If not empty, the snapshot is only accepted if it was taken of this TS
+///                   file as it is now.
+/// @return True if the snapshot was loaded.
+bool readCatalogSnapshot(const QString &snapshotPath, Catalog &catalog, const QString &sourcePath = QString());
+
+/// @brief Reads an API key from a specified file.
+/// @details This function opens a file containing the API key as plain text, reads its contents,
+/// and trims any extraneous whitespace or UTF-8 BOM if present.
+///
+/// @param apiKeyPath The path to the file containing the API key.
+/// @return The API key as a QString, or an empty string if the file could not be read.
+QString readApiKeyFromFile(const QString &apiKeyPath);
+
+/// @brief Marks the messages of a catalog that are to be translated as pending.
+/// @details A message is picked if its translation type is one of @p translateTypes, or if it
+/// has neither a translation nor a type. With the default {"unfinished"} new messages and
+/// unfinished ones with a stale draft are translated, while obsolete and vanished messages
+/// are left alone.
+///
+/// @return The number of pending messages.
+int selectMessages(Catalog &catalog, const QStringList &translateTypes);
+
+/// @brief Collects the distinct source texts of the pending messages of one or more catalogs.
+/// @details Strings such as "OK" or "Cancel" appear in many contexts and files; each one is
+/// returned once, in order of first appearance, and processResponse() later fans its
+/// translation out to every message with that source through the catalogs' source indexes.
+///
+/// @param catalogs The parsed catalogs, after selectMessages().
+/// @return The unique source texts that still need a translation.
+QStringList collectUntranslatedSources(const QList<Catalog> &catalogs);
+
+/// @brief Collects the distinct source texts of the pending messages grouped by context.
+/// @details Contexts matching an earlier @p contextPriority wildcard come first, the others
+/// follow in document order. Contexts with the same name in several files form one group. A
+/// source shared by several contexts belongs to the first group it appears in.
+///
+/// @param catalogs The parsed catalogs, after selectMessages().
+/// @param contextPriority Wildcard patterns of context names, highest priority first.
+/// @return One list of sources per context group, in priority order; empty groups are left out.
+QList<QStringList> collectSourcesByContext(const QList<Catalog> &catalogs, const QStringList &contextPriority);
+
+/// @brief Tells whether any pending message has the given source text.
+bool needsTranslation(const LanguageJob &job, const QString &source);
+
+/// @brief Roughly estimates the number of model tokens of a text.
+/// @details ASCII text averages about four characters per token; other scripts are counted
+/// as one token per character, which errs on the safe side for CJK and Cyrillic text.
+///
+/// @param text The text to estimate.
+/// @return The estimated token count.
+int estimateTokens(QStringView text);
+
+/// @brief Estimates the prompt and completion tokens of a whole request.
+int estimateBatchTokens(const QStringList &phrases);
+
+/// @brief Estimates the prompt tokens of a request: the instructions and the phrase list.
+int estimatePromptTokens(const QStringList &phrases);
+
+/// @brief Estimates the completion tokens of the answer to a request.
+/// @details Assumes the answer echoes every source; structured output answers are shorter.
+int estimateCompletionTokens(const QStringList &phrases);
+
+/// @brief Estimates how long sending the batches to one backend takes, for --plan.
+/// @details Each request is assumed to take a fixed overhead plus its completion tokens at
+/// @p tokensPerSecond, and the requests to spread evenly over the concurrent slots. The result
+/// is the longest of that and the time the request and token rate limits need for the whole
+/// run, after the first minute's allowance of each.
+///
+/// @return The expected duration in milliseconds.
+qint64 estimateDurationMs(const QList<QStringList> &batches, const BackendConfig &backend, int tokensPerSecond);
+
+/// @brief Packs phrases into batches that fit a token budget.
+/// @details Each phrase is charged estimatePhraseTokens(). A batch is closed when the next
+/// phrase would exceed @p maxTokens or the batch holds @p maxPhrases phrases.
+/// A phrase that exceeds the budget on its own is sent alone.
+///
+/// @param phrases The phrases to pack, in order.
+/// @param maxTokens The token budget of one request (prompt and completion). 0 disables it.
+/// @param maxPhrases The maximum number of phrases per batch.
+/// @return The batches in order.
+QList<QStringList> packBatches(const QStringList &phrases, int maxTokens, int maxPhrases);
+
+/// @brief Packs groups of phrases into batches without splitting a group that fits one batch.
+/// @details Like packBatches(), but a group that does not fit the rest of the current batch
+/// starts a new one, so the phrases of a context are sent together. Only groups larger than
+/// a batch are split.
+QList<QStringList> packGroupedBatches(const QList<QStringList> &groups, int maxTokens, int maxPhrases);
+
+/// @brief Sets the translation of every pending message with the given source text.
+///
+/// @param catalog The catalog to update. Its source index must have been built.
+/// @param source The source text that was translated.
+/// @param translation The translated text.
+/// @return True if at least one pending message carries the source text.
+bool applyTranslation(Catalog &catalog, const QString &source, const QString &translation);
+
+/// @brief Sets the translation of every pending message with the given source text in all files of a language.
+/// @return True if at least one pending message carries the source text.
+bool applyTranslation(LanguageJob &job, const QString &source, const QString &translation);
+
+/// @brief Takes translations over from the previous catalog of a TS file that was regenerated.
+/// @details A pending message of @p updated whose context and source were translated in
+/// @p previous gets that translation and stops being pending. Only messages that are new or
+/// whose source changed are left to translate. Messages the regenerated file already has
+/// finished are not touched.
+///
+/// @param updated The newly parsed catalog, after selectMessages().
+/// @param previous The catalog the file had before, with the translations applied since.
+/// @return The number of messages still pending.
+int carryOverTranslations(Catalog &updated, const Catalog &previous);
+
+/// @brief Appends a text to a JSON string being written, escaped and encoded as UTF-8.
+/// @details The quotes around the string are not written, so a string can be assembled from
+/// several pieces straight into a request body.
+void appendJsonEscaped(QByteArray &out, QStringView text);
+
+/// @brief Appends UTF-8 text, such as serialized JSON, to a JSON string being written, escaped.
+void appendJsonEscaped(QByteArray &out, QByteArrayView utf8);
+
+/// @brief Request bodies handed out again once the network stack has let go of them.
+/// @details QNetworkAccessManager::post() shares the QByteArray it is given until the
+/// request is done. A buffer nobody shares any more is emptied with its capacity kept, so at
+/// a steady concurrency no request body is reallocated. The pool grows to the largest number
+/// of requests in flight at once.
+class RequestBufferPool
+{
+public:
+    /// @brief An empty buffer to write the next request body to. Valid until the next call.
+    QByteArray &acquire();
+
+    /// @brief Notes the size of a finished body, to reserve as much for new buffers.
+    void release(const QByteArray &buffer) { m_largest = qMax(m_largest, buffer.size()); }
+
+private:
+    QList<QByteArray> m_buffers;
+    qsizetype m_largest = 4096;
+};
+
+/// @brief Pulls complete JSON objects out of text that arrives piece by piece.
+/// @details Only objects without nested objects are reported, which are exactly the
+/// {"source": ..., "translation": ...} or {"id": ..., "t": ...} entries however the model
+/// wraps them (plain array, the "items" object of a structured answer, code fence,
+/// surrounding prose). Braces inside strings are skipped. Everything before the
+/// first unfinished object is discarded, so the buffer stays as small as one entry.
+class JsonObjectScanner
+{
+public:
+    /// @brief Appends the next piece of text and scans it.
+    void feed(const QByteArray &data)
+    {
+        m_buffer.append(data);
+        scan();
+    }
+
+    /// @brief Returns the objects completed since the last call.
+    QList<QByteArray> takeObjects()
+    {
+        return std::exchange(m_objects, {});
+    }
+
+private:
+    struct Frame {
+        qsizetype start;
+        bool hasChild;
+    };
+
+    void scan();
+
+    QByteArray m_buffer;
+    qsizetype m_pos = 0;
+    bool m_inString = false;
+    bool m_escaped = false;
+    QList<Frame> m_stack;
+    QList<QByteArray> m_objects;
+};
+
+/// @brief The members of a JSON object without nested objects or arrays.
+/// @details Decodes the leaf objects found by JsonObjectScanner without building a
+/// QJsonDocument per object. Numbers, true, false and null are kept as their literal text.
+/// Keys are not decoded but refer to the parsed bytes, so only values are allocated, and a
+/// reused instance keeps the capacity of its member list.
+class FlatJsonObject
+{
+public:
+    /// @brief Decodes the object spanning the given bytes, from its '{' to its '}'.
+    /// @details The bytes must outlive the lookups with value().
+    /// @return False if it is not a well-formed flat object.
+    bool parse(const char *data, qsizetype size);
+
+    /// @brief The value of a member, or a null string if the object has no such member.
+    /// @details Keys are compared as written, so a key spelled with escapes does not match.
+    QString value(QLatin1String key) const;
+
+private:
+    QList<QPair<QByteArrayView, QString>> m_members;
+};
+
+/// @brief Splits a server-sent event stream into the payloads of its "data:" lines.
+class SseReader
+{
+public:
+    /// @brief Appends received bytes.
+    void feed(const QByteArray &data)
+    {
+        m_buffer.append(data);
+    }
+
+    /// @brief Returns the payloads of all complete lines received so far.
+    QList<QByteArray> takeEvents();
+
+private:
+    QByteArray m_buffer;
+};
+
+/// @brief Applies one {"source": ..., "translation": ...} or {"id": ..., "t": ...} object of a model answer.
+/// @details An ID is the position of the phrase in its batch, so the source is looked up
+/// instead of being matched against the text the model echoed.
+///
+/// @param object The serialized object.
+/// @param job The language whose messages are updated.
+/// @param applied Receives the translation if it was applied.
+/// @param phrases The phrases of the batch, in the order their IDs were given.
+void applyTranslationObject(const QByteArray &object, LanguageJob &job, QHash<QString, QString> &applied,
+                            const QStringList &phrases = QStringList());
+
+/// @brief Incrementally applies a streamed (stream: true) chat completion.
+/// @details Fed from QNetworkReply::readyRead, it extracts the delta content of every event
+/// and applies each translation object as soon as its closing brace has arrived, so a
+/// response that is cut off still keeps every entry it completed.
+class StreamedResponse
+{
+public:
+    /// @param job The language whose messages are updated as entries arrive.
+    /// @param phrases The phrases of the batch, which IDs in the answer refer to.
+    explicit StreamedResponse(LanguageJob &job, const QStringList &phrases = QStringList())
+        : m_job(job)
+        , m_phrases(phrases)
+    {
+    }
+
+    /// @brief Consumes newly received bytes of the event stream.
+    void feed(const QByteArray &data);
+
+    /// @brief The translations applied so far, keyed by source text.
+    const QHash<QString, QString> &applied() const { return m_applied; }
+
+private:
+    LanguageJob &m_job;
+    QStringList m_phrases;
+    SseReader m_events;
+    JsonObjectScanner m_objects;
+    QHash<QString, QString> m_applied;
+};
+
+/// @brief Processes an API response and updates the translated messages.
+/// @details This function parses the JSON envelope of the GPT API response once and scans
+/// the answer content for translation objects in a single pass, without regular expressions
+/// or a second JSON document. Every well-formed object is recovered even if the model wraps
+/// the array in a code fence, adds prose or the output is cut off; sources the answer leaves
+/// out are simply not in the result, so the caller re-queues only those.
+///
+/// @param responseData The raw API response data as a QByteArray.
+/// @param job The language whose messages are updated.
+/// @param phrases The phrases of the batch, which IDs in the answer refer to.
+/// @return The translations that were applied, keyed by source text.
+QHash<QString, QString> processResponse(const QByteArray &responseData, LanguageJob &job,
+                                        const QStringList &phrases = QStringList());
+
+/// @brief Fixed translations of product terms, given to the model with the batches that use them.
+/// @details The glossary is a JSON array of objects such as
+/// {"term": "Workspace", "translations": {"German": "Arbeitsbereich"}, "note": "..."}, keyed by
+/// the target language names of the config. All terms are compiled into one regular expression
+/// on load, so finding the terms of a batch is a single scan per phrase. Only the terms that
+/// occur in a batch are listed in its prompt; the instructions stay the same for every request.
+class Glossary
+{
+public:
+    /// @brief Reads the glossary file and compiles its terms.
+    /// @return True if the file could be read and parsed.
+    bool load(const QString &path);
+
+    bool isEmpty() const { return m_entries.isEmpty(); }
+
+    /// @brief The prompt section listing the glossary terms that occur in a batch.
+    /// @details Terms are listed in glossary order, so equal batches get equal prompts. A term
+    /// without a translation for @p lang is listed only if it has a note.
+    /// @return The section, or an empty string if no term occurs.
+    QString promptSection(const QStringList &phrases, const QString &lang) const;
+
+private:
+    struct Entry {
+        QString term;
+        QHash<QString, QString> translations; ///< Translation per target language name.
+        QString note;
+    };
+
+    QList<Entry> m_entries;
+    QHash<QString, int> m_entryOfTerm; ///< Case folded term to its index in m_entries.
+    QRegularExpression m_pattern;
+};
+
+/// @brief A service translations are requested from.
+/// @details A backend builds the requests for its API and parses the answers. The scheduler
+/// keeps a queue, a concurrency limit and a rate limiter per backend, and moves the phrases a
+/// backend gives up on to the next configured one.
+class TranslationBackend
+{
+public:
+    explicit TranslationBackend(const BackendConfig &config)
+        : m_config(config)
+    {
+    }
+    virtual ~TranslationBackend() = default;
+
+    /// @brief The configuration the backend was created with.
+    const BackendConfig &config() const { return m_config; }
+
+    /// @brief Opens the connection to the API host ahead of the first request.
+    virtual void warmUp() = 0;
+
+    /// @brief Posts a batch of phrases without waiting for the answer.
+    /// @return The pending reply. The caller owns it and must delete it once it has finished.
+    virtual QNetworkReply *sendTranslationBatch(const QStringList &phrases, const QString &lang,
+                                                const QString &langPostfix) = 0;
+
+    /// @brief Applies the complete answer to a batch and returns the applied translations.
+    /// @param phrases The phrases the batch was sent with.
+    virtual QHash<QString, QString> processResponse(const QByteArray &responseData, LanguageJob &job,
+                                                    const QStringList &phrases) = 0;
+
+    /// @brief Creates the incremental parser of a streamed answer.
+    /// @param phrases The phrases the batch was sent with.
+    /// @return The parser, owned by the caller, or null if the backend does not stream.
+    virtual StreamedResponse *createStream(LanguageJob &job, const QStringList &phrases) = 0;
+
+private:
+    BackendConfig m_config;
+};
+
+/// @brief Backend for OpenAI compatible chat completions APIs, such as OpenAI itself or a
+/// self-hosted vLLM server.
+/// @details The backend owns a single QNetworkAccessManager, so TCP and TLS sessions to the
+/// API host are kept alive and reused between batches instead of being renegotiated for each
+/// request. When HTTP/2 is enabled the concurrent requests are multiplexed over one connection.
+/// A request that transfers nothing for BackendConfig::requestTimeoutMs is aborted, so a
+/// stalled connection fails like any other request instead of holding its slot forever.
+///
+/// With structured output the phrases are sent as a JSON object keyed by their position in
+/// the batch, and response_format asks for {"items": [{"id": ..., "t": ...}]} under a strict
+/// JSON schema. The answer then carries no copy of the sources, which roughly halves the
+/// completion tokens, and translations map back by ID even where the model would have
+/// altered the echoed source text.
+class ChatCompletionsBackend : public TranslationBackend
+{
+public:
+    /// @param config The endpoint, model and limits of the backend.
+    /// @param apiKey The API key used for authentication. No Authorization header is sent if empty.
+    /// @param glossary The terms listed with the batches that use them. Optional, not owned.
+    ChatCompletionsBackend(const BackendConfig &config, const QString &apiKey, const Glossary *glossary = nullptr);
+
+    /// @brief Opens the connection to the API host ahead of the first request.
+    /// @details The handshake then overlaps with parsing and batch building instead of
+    /// delaying the first batch.
+    void warmUp() override;
+
+    /// @brief Sends a batch of phrases to the GPT API for translation.
+    /// @details This function constructs a request to the GPT API, formatting the phrases as a prompt,
+    /// and posts it without waiting for the answer.
+    /// The API response is expected to be a JSON array of objects with source and translated text.
+    /// All instructions are in the system message, which is the same for every request and
+    /// language, so providers that cache prompt prefixes serve it from their cache. The user
+    /// message only carries the language, the glossary terms of the batch and the phrases, as a
+    /// JSON array so that phrases with line breaks stay whole.
+    /// The body is serialized into a buffer of a RequestBufferPool.
+    ///
+    /// @param phrases A list of phrases to be translated.
+    /// @param lang The target language for translation.
+    /// @param langPostfix (EN_en, TR_tr ...)
+    /// @return The pending reply. The caller owns it and must delete it once it has finished.
+    QNetworkReply *sendTranslationBatch(const QStringList &phrases, const QString &lang,
+                                        const QString &langPostfix) override;
+
+    QHash<QString, QString> processResponse(const QByteArray &responseData, LanguageJob &job,
+                                            const QStringList &phrases) override
+    {
+        return ::processResponse(responseData, job, phrases);
+    }
+
+    StreamedResponse *createStream(LanguageJob &job, const QStringList &phrases) override
+    {
+        return config().stream ? new StreamedResponse(job, phrases) : nullptr;
+    }
+
+private:
+    /// The instructions of every request. Must not depend on the batch or the language.
+    static constexpr const char *kSystemPrompt =
+        "You are a translation assistant for software user interfaces. Translate each phrase of the JSON "
+        "array of strings after \"Phrases:\" in the user message into the language the message names. A "
+        "phrase may span several lines. Keep placeholders such as %1, &-mnemonics and HTML tags intact. Return only a JSON array of objects in the format "
+        "[{\"source\": \"<original>\", \"translation\": \"<translated>\"}], with one object per phrase "
+        "and the source copied verbatim. If the message has a \"Glossary:\" section, translate its terms "
+        "exactly as given there.";
+
+    /// The instructions of every request in structured output mode.
+    static constexpr const char *kStructuredSystemPrompt =
+        "You are a translation assistant for software user interfaces. The user message names a "
+        "language and, after \"Phrases:\", a JSON object of phrases keyed by ID. Translate every phrase "
+        "into that language and answer with one item per phrase, giving its ID and the translation. "
+        "Keep placeholders such as %1, &-mnemonics and HTML tags intact. If the message has a "
+        "\"Glossary:\" section, translate its terms exactly as given there.";
+
+    /// @brief The response_format asking for {"items": [{"id": <int>, "t": <string>}]}.
+    static QJsonObject structuredResponseFormat();
+
+    QString m_apiKey;
+    const Glossary *m_glossary;
+    QUrl m_endpoint;
+    QSslConfiguration m_sslConfig;
+    QNetworkRequest m_request;  ///< The headers of every request.
+    QByteArray m_bodyPrefix;    ///< The request body up to the content of the user message.
+    QByteArray m_phraseList;    ///< Scratch buffer for the JSON array or object of the phrases.
+    RequestBufferPool m_bodies;
+    QNetworkAccessManager m_networkManager;
+};
+
+/// @brief Append-only log file with one compact JSON object per line.
+/// @details Used for data that must survive an interrupted run. Lines that do not parse,
+/// such as a last line cut off by a crash, are skipped when the log is read back, and a
+/// missing final newline is restored before anything new is appended.
+class JsonLinesLog
+{
+public:
+    /// @brief Reads every entry of the log and opens it for appending.
+    /// @param path The path of the log. Created if it does not exist, unless read only.
+    /// @param onEntry Called for each entry already in the log.
+    /// @param readOnly Only reads the entries. The file is left untouched and append() is not allowed.
+    /// @return True if the log could be opened for appending, or read if read only.
+    bool open(const QString &path, const std::function<void(const QJsonObject &)> &onEntry, bool readOnly = false);
+
+    bool isOpen() const { return m_file.isOpen(); }
+
+    /// @brief Appends one entry. It reaches the disk with the next flush() or sync().
+    void append(const QJsonObject &entry)
+    {
+        m_file.write(QJsonDocument(entry).toJson(QJsonDocument::Compact));
+        m_file.write("\n");
+    }
+
+    /// @brief Hands appended entries to the operating system.
+    void flush()
+    {
+        m_file.flush();
+    }
+
+    /// @brief Flushes and waits until appended entries are stored on the disk.
+    void sync();
+
+    /// @brief Closes and deletes the log.
+    void remove()
+    {
+        m_file.close();
+        m_file.remove();
+    }
+
+private:
+    QFile m_file;
+};
+
+/// @brief Persistent translation memory shared between runs.
+/// @details Translations are stored in a JsonLinesLog keyed by source text, target language
+/// and model. The whole log is loaded into a hash index on open; new entries are appended and
+/// flushed as responses arrive, so a run that is interrupted keeps everything translated so far.
+class TranslationMemory
+{
+public:
+    /// @brief Loads the log at the given path and opens it for appending.
+    /// @param path The path of the translation memory log. Created if it does not exist, unless read only.
+    /// @param readOnly Only loads the entries. Stored translations are then kept in memory only.
+    /// @return True if the log could be opened for appending, or read if read only.
+    bool open(const QString &path, bool readOnly = false);
+
+    /// @brief Looks up a stored translation and updates the hit/miss counters.
+    /// @param models The models whose translations are accepted, in order of preference.
+    /// @param translation Receives the stored translation on a hit.
+    /// @return True on a hit.
+    bool lookup(const QString &source, const QString &lang, const QStringList &models, QString *translation);
+
+    /// @brief Records a translation and appends it to the log unless it is already stored.
+    void store(const QString &source, const QString &lang, const QString &model, const QString &translation);
+
+    /// @brief Pushes appended entries to disk.
+    void flush()
+    {
+        if (m_log.isOpen())
+            m_log.flush();
+    }
+
+    int hits() const { return m_hits; }
+    int misses() const { return m_misses; }
+
+private:
+    static QString key(const QString &source, const QString &lang, const QString &model)
+    {
+        return lang + QChar(0x1F) + model + QChar(0x1F) + source;
+    }
+
+    JsonLinesLog m_log;
+    QHash<QString, QString> m_entries;
+    int m_hits = 0;
+    int m_misses = 0;
+};
+
+/// @brief Crash-safe journal of the translations applied during the current run.
+/// @details Every applied batch result is appended and synced to disk before the scheduler
+/// moves on. If a run is interrupted, the next run with the same journal replays it over the
+/// freshly parsed TS file and only sends what is still missing. The journal is deleted once
+/// the outputs of a run have been written.
+class CheckpointJournal
+{
+public:
+    /// @brief Opens the journal, keeping the entries of an interrupted run for replay().
+    /// @param readOnly Only reads the entries. Nothing is recorded then.
+    /// @return True if the journal could be opened for appending, or read if read only.
+    bool open(const QString &path, bool readOnly = false)
+    {
+        return m_log.open(path, [this](const QJsonObject &entry) {
+            m_replay.append({entry["l"].toString(), entry["s"].toString(), entry["t"].toString()});
+        }, readOnly);
+    }
+
+    /// @brief Applies the entries of an interrupted run to the matching languages.
+    /// @return The number of entries applied.
+    int replay(QList<LanguageJob> &jobs);
+
+    /// @brief Appends the result of one batch and syncs it to disk.
+    void record(const QString &lang, const QHash<QString, QString> &applied);
+
+    /// @brief Deletes the journal after a completed run.
+    void remove()
+    {
+        m_log.remove();
+    }
+
+private:
+    struct Entry {
+        QString lang;
+        QString source;
+        QString translation;
+    };
+
+    JsonLinesLog m_log;
+    QList<Entry> m_replay;
+};
+
+/// @brief Parses a rate limit reset duration such as "1s", "6m0s", "1.5s" or "20ms".
+/// @return The duration in milliseconds, or -1 if the value cannot be parsed.
+qint64 parseResetDuration(const QByteArray &value);
+
+/// @brief Reads the delay a server asked for through Retry-After or retry-after-ms.
+/// @return The delay in milliseconds, or -1 if the reply carries no such header.
+qint64 retryAfterMs(const QNetworkReply *reply);
+
+/// @brief Client side token bucket for the API's requests and tokens per minute limits.
+/// @details Both buckets refill continuously at their per-minute rate. The configured limits
+/// are tightened by the x-ratelimit-* headers of every reply: the remaining counts reported
+/// by the server cap the local buckets, a limit header fills in a rate that was not
+/// configured, and an exhausted bucket blocks until the reported reset time.
+class RateLimiter
+{
+public:
+    /// @param requestsPerMinute The requests per minute limit. 0 means unlimited.
+    /// @param tokensPerMinute The tokens per minute limit. 0 means unlimited.
+    RateLimiter(int requestsPerMinute, int tokensPerMinute)
+        : m_requestsPerMinute(requestsPerMinute)
+        , m_tokensPerMinute(tokensPerMinute)
+        , m_requests(requestsPerMinute)
+        , m_tokens(tokensPerMinute)
+    {
+        m_clock.start();
+    }
+
+    /// @brief Returns how long a request of the given size has to wait.
+    /// @return The delay in milliseconds, 0 if the request can be sent now.
+    qint64 delayFor(int tokens);
+
+    /// @brief Takes one request and the given tokens out of the buckets.
+    void consume(int tokens);
+
+    /// @brief Blocks every request for the given time, e.g. after a 429 response.
+    void pause(qint64 ms)
+    {
+        m_blockedUntil = qMax(m_blockedUntil, m_clock.elapsed() + ms);
+    }
+
+    /// @brief Adjusts the buckets to the x-ratelimit-* headers of a reply.
+    void update(const QNetworkReply *reply)
+    {
+        refill();
+        updateBucket(reply, "requests", m_requestsPerMinute, m_requests);
+        updateBucket(reply, "tokens", m_tokensPerMinute, m_tokens);
+    }
+
+private:
+    void updateBucket(const QNetworkReply *reply, const QByteArray &kind, int &perMinute, double &available);
+
+    void refill();
+
+    int m_requestsPerMinute;
+    int m_tokensPerMinute;
+    double m_requests;
+    double m_tokens;
+    QElapsedTimer m_clock;
+    qint64 m_lastRefill = 0;
+    qint64 m_blockedUntil = 0;
+};
+
+/// @brief Keeps several translation batches in flight on a single event loop.
+/// @details Batches are queued with addBatch() and sent by run(). Every backend has its own
+/// queue: at most BackendConfig::maxConcurrentRequests of its replies are pending at any
+/// time, and its RateLimiter holds batches back while its requests or tokens per minute
+/// budget is spent. Whenever a reply finishes its response is applied to the messages right
+/// away and the next queued batch is sent, so the total run time shrinks with the
+/// concurrency limit.
+///
+/// Batches of several target languages can be queued on the same scheduler; they share the
+/// concurrency and rate limits of the backends.
+///
+/// Failed batches are not dropped: rate limited (429), timed out (see
+/// BackendConfig::requestTimeoutMs), server side and connection failures are retried after the server's Retry-After delay or a jittered exponential
+/// backoff. A response that cannot be parsed splits its batch in halves, and phrases a
+/// response leaves out are queued again on their own, each up to Config::maxRetries times.
+/// Phrases a backend gives up on, after its retries or on a permanent error, move on to the
+/// next backend in the configured order.
+///
+/// With Config::adaptiveBatching the batch size and concurrency of every backend follow its
+/// replies instead of staying at api_call_size and max_concurrent_requests: queued batches
+/// are split or filled up when they are sent, and each reply moves the limits, see adapt().
+class BatchScheduler
+{
+public:
+    /// @param config The loaded configuration (retry settings).
+    /// @param backends The backends in fallback order; new batches go to the first one.
+    /// @param memory Optional translation memory filled with every applied translation.
+    /// @param journal Optional checkpoint journal every applied batch result is synced to.
+    BatchScheduler(const Config &config, const QList<TranslationBackend *> &backends,
+                   TranslationMemory *memory = nullptr, CheckpointJournal *journal = nullptr);
+
+    /// @brief Queues a batch of phrases for translation.
+    /// @param phrases The phrases to translate.
+    /// @param job The language the phrases are translated into and whose messages are updated.
+    void addBatch(const QStringList &phrases, LanguageJob *job);
+
+    /// @brief Sends every queued batch and returns once all replies have been processed.
+    void run();
+
+private:
+    /// Exercises adapt() and resizeHead() on a scheduler that is not running.
+    friend class TestAutoTranslator;
+
+    /// @brief A queued batch, its language, its backend and the number of times it has been retried there.
+    struct PendingBatch {
+        QStringList phrases;
+        LanguageJob *job;
+        int backend;
+        int attempt;
+        qint64 queuedAt; ///< metrics() time at which the batch was queued.
+        int origin;      ///< The addBatch() call the phrases came from, kept by splits and retries.
+    };
+
+    /// @brief Timestamps of one request on the metrics() clock.
+    struct RequestTrace {
+        qint64 sentAt;
+        qint64 firstByteAt = -1;
+    };
+
+    /// @brief The queue and limits of one backend.
+    struct BackendState {
+        explicit BackendState(TranslationBackend *backend)
+            : backend(backend)
+            , rateLimiter(backend->config().requestsPerMinute, backend->config().tokensPerMinute)
+        {
+        }
+
+        TranslationBackend *backend;
+        RateLimiter rateLimiter;
+        QQueue<PendingBatch> pending;
+        int inFlight = 0;
+        bool dispatchTimerArmed = false;
+        int batchSize = 1;   ///< Phrases per request chosen by adaptive batching.
+        int concurrency = 1; ///< Requests in flight allowed by adaptive batching.
+        int goodReplies = 0; ///< Replies that passed the quality gate since concurrency last changed.
+        double phrasesPerSecond = 0; ///< Moving average of the translated phrases per second of a request.
+    };
+
+    /// @brief Prints one line of live progress.
+    void reportProgress() const;
+
+    bool isDone() const;
+
+    /// @brief Sends queued batches of every backend.
+    void dispatchPending()
+    {
+        for (int i = 0; i < m_backends.size(); ++i)
+            dispatchPending(i);
+    }
+
+    /// @brief Sends queued batches of one backend until its concurrency or rate limit is reached.
+    void dispatchPending(int index);
+
+    /// @brief Applies a finished reply, schedules retries and refills the free slot.
+    /// @param stream The incremental parser of the reply in streaming mode, otherwise null.
+    /// @param trace When the request was sent and its first bytes arrived.
+    void handleReply(QNetworkReply *reply, const PendingBatch &batch, StreamedResponse *stream,
+                     const RequestTrace &trace);
+
+    /// @brief Splits or fills the next batch of a backend to its adaptive batch size.
+    /// @details A batch that is too large leaves its tail at the front of the queue. One that
+    /// is too small takes phrases from later batches of the same language, within the token
+    /// budget of a request. As the batches were packed keeping context groups whole, only
+    /// pieces of the head's own batch are taken in part; other batches are taken whole or
+    /// not at all, and filling stops at the first one that does not fit.
+    void resizeHead(BackendState &state);
+
+    /// @brief Moves the batch size and concurrency of a backend after a reply, AIMD style.
+    /// @details A reply passes the quality gate if it succeeded and translated all but a few of
+    /// its phrases. Passing replies grow the batch size by a few phrases as long as a request
+    /// keeps translating about as many phrases per second as before, and add one concurrent
+    /// request per window of passing replies. Rate limiting and server errors halve the
+    /// concurrency; failed requests and incomplete answers, typically timeouts and truncated
+    /// output of large requests, halve the batch size. Every change is logged in metrics().
+    void adapt(BackendState &state, const PendingBatch &batch, int appliedCount, bool failed, int status,
+               qint64 latencyMs);
+
+    /// @brief Queues phrases again on the batch's backend after a delay, or hands them to the
+    /// next backend once the retries are exhausted.
+    /// @param delay The delay in milliseconds; a negative value selects the backoff delay.
+    void retry(const QStringList &phrases, const PendingBatch &batch, qint64 delay);
+
+    /// @brief Queues phrases on the backend after the batch's one, or gives up on them if there is none.
+    void fallBack(const QStringList &phrases, const PendingBatch &batch);
+
+    /// @brief Returns the exponential backoff for the given attempt with +/-50% jitter.
+    static qint64 backoffDelay(int attempt)
+    {
+        const qint64 base = qMin<qint64>(60000, 1000LL << qMin(attempt, 6));
+        return base / 2 + QRandomGenerator::global()->bounded(base);
+    }
+
+    /// @brief Tells whether a failed request is worth sending again.
+    static bool isTransientFailure(QNetworkReply::NetworkError error, int status);
+
+    /// Smallest batch adaptive batching shrinks to, unless Config::apiCallSize is smaller.
+    static constexpr int kAdaptiveMinBatchSize = 5;
+    /// Phrases a batch grows by after a reply that passed the quality gate.
+    static constexpr int kAdaptiveBatchStep = 5;
+    /// Share of missing phrases above which an answer counts as incomplete.
+    static constexpr double kAdaptiveMaxMissingFraction = 0.05;
+
+    const Config &m_config;
+    TranslationMemory *m_memory;
+    CheckpointJournal *m_journal;
+    QList<BackendState> m_backends;
+    int m_waitingRetries = 0;
+    int m_droppedPhrases = 0;
+    int m_plannedPhrases = 0;
+    int m_appliedPhrases = 0;
+    int m_nextOrigin = 0;
+    QEventLoop m_eventLoop;
+};
+
+/// @brief Reports TS files once a tool such as lupdate has finished rewriting them.
+/// @details Changes are collected until the files have been quiet for a moment, so a file
+/// that is written in several steps is reported once. Files that are replaced rather than
+/// rewritten drop out of QFileSystemWatcher and are added back. Changes that arrive while
+/// the callback runs, e.g. from writing a TS file back to itself, are reported after it.
+class TsFileWatcher
+{
+public:
+    /// @param paths The TS files to watch.
+    /// @param onChanged Called from the event loop with the changed files, in the order of @p paths.
+    /// @param settleMs The quiet time after the last change before the files are reported.
+    TsFileWatcher(const QStringList &paths, const std::function<void(const QStringList &)> &onChanged,
+                  int settleMs = 500);
+
+private:
+    void report();
+
+    QStringList m_paths;
+    std::function<void(const QStringList &)> m_onChanged;
+    QFileSystemWatcher m_watcher;
+    QTimer m_settle;
+    QSet<QString> m_changed;
+    bool m_busy = false;
+};
+
+/// @brief Inserts a language postfix before the extension of a file path.
+/// @details "dir/app.ts" with postfix "tr" becomes "dir/app_tr.ts".
+QString suffixedPath(const QString &path, const QString &postfix);
+
+/// @brief Expands the configured TS path into the TS files to translate.
+/// @details A directory yields every *.ts file in it, a path whose file name contains
+/// wildcards ("translations/*_de.ts") the files matching it, both sorted by name. Any
+/// other path is taken as a single TS file.
+QStringList expandTsFilePaths(const QString &path);
+
+/// @brief Resolves where the results of one TS file of a target go.
+/// @details With a single TS file the target's own paths are used. In multi-file mode every
+/// file is written in place if the target writes back to the configured path, and next to
+/// itself with the target's postfix otherwise. CSV files are then named after the output TS
+/// file and kept in the directory of the target's CSV path. Snapshots are named after the
+/// output TS file and the target's postfix, in Config::snapshotDir.
+TsFileJob resolveTsFileJob(const Config &config, const TranslationTarget &target, const QString &tsFile,
+                           bool multiFile);
+
+/// @brief Loads configuration settings from a JSON file.
+/// @details This function reads a JSON configuration file, parses its content,
+/// and populates a Config structure with the extracted values.
+/// Exits the program if the configuration file is missing or invalid.
+///
+/// @param configPath The path to the configuration file.
+/// @return A Config structure populated with the loaded settings.
+Config loadConfig(const QString &configPath);
+
+#endif // AUTO_TRANSLATOR_H
@@ -0,0 +1,225 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include "auto_translator.h"
+#include "mock_translation_server.h"
+#include "synthetic_ts.h"
+
+static bool verboseOutput = false;
+
+/// @brief Drops debug output of the measured functions unless --verbose is given.
+static void benchMessageHandler(QtMsgType type, const QMessageLogContext &, const QString &message)
+{
+    if (type == QtDebugMsg && !verboseOutput)
+        return;
+    QTextStream(stderr) << message << '\n';
+}
+
+/// @brief Runs a function the given number of times and returns the average in milliseconds.
+template <typename Function>
+static double measure(int iterations, Function &&function)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+        function();
+    return double(timer.nsecsElapsed()) / 1e6 / qMax(1, iterations);
+}
+
+static void report(const QString &name, double milliseconds, const QString &note = QString())
+{
+    QTextStream(stdout) << QStringLiteral("%1 %2 ms  %3").arg(name, -28).arg(milliseconds, 10, 'f', 3).arg(note)
+                        << Qt::endl;
+}
+
+/// @brief Counts the messages of a catalog that are still untranslated.
+static int untranslatedCount(const Catalog &catalog)
+{
+    int count = 0;
+    for (const MessageInfo &msg : catalog.messages())
+        count += msg.translation.isEmpty() ? 1 : 0;
+    return count;
+}
+
+//---------------------------------------------------------------------
+// Benchmark driver
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("Qt GPT Translator Benchmarks");
+    app.setApplicationVersion("1.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmark the translation pipeline on synthetic TS files and a local mock API");
+    parser.addHelpOption();
+    QCommandLineOption contextsOption("contexts", "Number of contexts of the synthetic TS file.", "count", "50");
+    QCommandLineOption messagesOption("messages", "Number of messages per context.", "count", "40");
+    QCommandLineOption locationsOption("locations", "Number of locations per message.", "count", "2");
+    QCommandLineOption duplicatesOption("duplicates", "Share of messages repeating an earlier source (0-1).", "rate", "0.3");
+    QCommandLineOption iterationsOption("iterations", "Repetitions of every local benchmark.", "count", "5");
+    QCommandLineOption latencyOption("latency", "Mock API latency per request in milliseconds.", "ms", "50");
+    QCommandLineOption rpmOption("rpm", "Requests per minute accepted by the mock API. 0 means unlimited.", "count", "0");
+    QCommandLineOption tpmOption("tpm", "Tokens per minute accepted by the mock API. 0 means unlimited.", "count", "0");
+    QCommandLineOption concurrencyOption("concurrency", "Maximum concurrent requests of the pipeline run.", "count", "4");
+    QCommandLineOption batchSizeOption("batch-size", "Maximum phrases per request.", "count", "50");
+    QCommandLineOption streamOption("stream", "Stream the mock API responses.");
+    QCommandLineOption structuredOption("structured", "Send phrases with IDs and ask for structured output.");
+    QCommandLineOption adaptiveOption("adaptive", "Adapt batch size and concurrency to the mock API's replies.");
+    QCommandLineOption noPipelineOption("no-pipeline", "Skip the pipeline run against the mock API.");
+    QCommandLineOption verboseOption("verbose", "Show the debug output of the measured functions.");
+    QCommandLineOption reportOption("report", "Write the metrics report of all runs to this JSON file.", "path");
+    parser.addOptions({contextsOption, messagesOption, locationsOption, duplicatesOption, iterationsOption, latencyOption,
+                       rpmOption, tpmOption, concurrencyOption, batchSizeOption, streamOption, structuredOption,
+                       adaptiveOption, noPipelineOption, verboseOption, reportOption});
+    parser.process(app);
+
+    verboseOutput = parser.isSet(verboseOption);
+    qInstallMessageHandler(benchMessageHandler);
+
+    SyntheticTsOptions tsOptions;
+    tsOptions.contexts = parser.value(contextsOption).toInt();
+    tsOptions.messagesPerContext = parser.value(messagesOption).toInt();
+    tsOptions.locationsPerMessage = parser.value(locationsOption).toInt();
+    tsOptions.duplicateRate = parser.value(duplicatesOption).toDouble();
+    const int iterations = qMax(1, parser.value(iterationsOption).toInt());
+    const int batchSize = qMax(1, parser.value(batchSizeOption).toInt());
+    const int maxTokens = 6000;
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        qCritical() << "Unable to create a temporary directory.";
+        return 1;
+    }
+    const QString tsPath = dir.filePath("synthetic.ts");
+    const QString outPath = dir.filePath("synthetic_out.ts");
+    const QString csvPath = dir.filePath("synthetic.csv");
+    if (!writeSyntheticTs(tsPath, tsOptions))
+        return 1;
+    QTextStream(stdout) << "Synthetic TS: " << tsOptions.contexts << " contexts, "
+                        << tsOptions.contexts * tsOptions.messagesPerContext << " messages, "
+                        << QFileInfo(tsPath).size() / 1024 << " KiB" << Qt::endl;
+
+    // Parsing and indexing.
+    Catalog parsed;
+    report("parse (mapped)", measure(iterations, [&]() { parsed = parseTsFile(tsPath, TsReadMode::Mapped); }));
+    report("parse (stream)", measure(iterations, [&]() { parsed = parseTsFile(tsPath, TsReadMode::Stream); }));
+    report("parse (parallel)", measure(iterations, [&]() { parsed = parseTsFile(tsPath, TsReadMode::Parallel); }));
+    report("index", measure(iterations, [&]() {
+        Catalog catalog = parsed;
+        catalog.buildSourceIndex();
+    }));
+    parsed.buildSourceIndex();
+    selectMessages(parsed, {QStringLiteral("unfinished")});
+
+    const QStringList sources = collectUntranslatedSources({parsed});
+    QList<QStringList> batches;
+    report("pack batches", measure(iterations, [&]() { batches = packBatches(sources, maxTokens, batchSize); }),
+           QStringLiteral("%1 unique phrases, %2 batches").arg(sources.size()).arg(batches.size()));
+
+    // Response handling, fed with the bodies the mock API would answer.
+    QList<QByteArray> responses;
+    QList<QByteArray> structuredResponses;
+    for (const QStringList &batch : std::as_const(batches)) {
+        responses.append(MockTranslationServer::completionBody(MockTranslationServer::translationContent(batch, "German")));
+        structuredResponses.append(
+            MockTranslationServer::completionBody(MockTranslationServer::structuredContent(batch, "German")));
+    }
+    LanguageJob job;
+    job.target.lang = "German";
+    job.target.langPostfix = "DE_de";
+    job.files.append(TsFileJob());
+    job.files.last().catalog = parsed;
+    // Every iteration starts from the untranslated catalog, as only pending messages are updated.
+    report("processResponse", measure(iterations, [&]() {
+        job.files.last().catalog = parsed;
+        for (const QByteArray &response : std::as_const(responses))
+            processResponse(response, job);
+    }));
+    report("processResponse (ids)", measure(iterations, [&]() {
+        job.files.last().catalog = parsed;
+        for (int i = 0; i < structuredResponses.size(); ++i)
+            processResponse(structuredResponses.at(i), job, batches.at(i));
+    }));
+    const Catalog &translated = job.files.last().catalog;
+
+    // Outputs.
+    report("CSV export", measure(iterations, [&]() { exportToCsv(csvPath, translated); }));
+    report("CSV export (changed only)",
+           measure(iterations, [&]() { exportToCsv(dir.filePath("changed.csv"), translated, true); }));
+    report("CSV import", measure(iterations, [&]() {
+        Catalog catalog = parsed;
+        importFromCsv(csvPath, catalog);
+    }));
+    report("TS write (full)", measure(iterations, [&]() { writeTsFile(outPath, translated); }));
+    report("TS write (incremental)", measure(iterations, [&]() { writeTsFileIncremental(tsPath, outPath, translated); }));
+    const QString snapshotPath = dir.filePath("synthetic.qats");
+    report("snapshot write", measure(iterations, [&]() { writeCatalogSnapshot(snapshotPath, translated, tsPath); }));
+    report("snapshot read", measure(iterations, [&]() {
+        Catalog catalog;
+        readCatalogSnapshot(snapshotPath, catalog, tsPath);
+    }), QStringLiteral("%1 KiB").arg(QFileInfo(snapshotPath).size() / 1024));
+
+    // The whole network stage against the local mock API.
+    if (!parser.isSet(noPipelineOption)) {
+        MockServerOptions serverOptions;
+        serverOptions.latencyMs = parser.value(latencyOption).toInt();
+        serverOptions.requestsPerMinute = parser.value(rpmOption).toInt();
+        serverOptions.tokensPerMinute = parser.value(tpmOption).toInt();
+        MockTranslationServer server(serverOptions);
+        if (!server.listen()) {
+            qCritical() << "Unable to start the mock API server.";
+            return 1;
+        }
+
+        Config config{};
+        config.apiCallSize = batchSize;
+        config.maxTokensPerRequest = maxTokens;
+        config.maxRetries = 5;
+        config.adaptiveBatching = parser.isSet(adaptiveOption);
+        config.adaptiveMaxBatchSize = 4 * batchSize;
+
+        BackendConfig backendConfig{};
+        backendConfig.name = "mock";
+        backendConfig.endpoint = server.endpoint().toString();
+        backendConfig.model = "mock";
+        backendConfig.maxConcurrentRequests = parser.value(concurrencyOption).toInt();
+        backendConfig.stream = parser.isSet(streamOption);
+        backendConfig.structuredOutput = parser.isSet(structuredOption);
+
+        LanguageJob pipelineJob;
+        pipelineJob.target = job.target;
+        pipelineJob.files.append(TsFileJob());
+        pipelineJob.files.last().catalog = parsed;
+
+        QElapsedTimer timer;
+        timer.start();
+        ChatCompletionsBackend backend(backendConfig, "mock-key");
+        backend.warmUp();
+        BatchScheduler scheduler(config, {&backend});
+        for (const QStringList &batch : packBatches(sources, config.maxTokensPerRequest, config.apiCallSize))
+            scheduler.addBatch(batch, &pipelineJob);
+        scheduler.run();
+        report("pipeline (mock API)", double(timer.nsecsElapsed()) / 1e6,
+               QStringLiteral("%1 requests, %2 rejected, %3 messages left untranslated")
+                   .arg(server.requests())
+                   .arg(server.rejected())
+                   .arg(untranslatedCount(pipelineJob.files.last().catalog)));
+    }
+
+    // Allocations per run of every stage, which should not grow with the concurrency.
+    if (kAllocationCounters) {
+        const QJsonObject stages = metrics().toJson()["stages"].toObject();
+        for (auto it = stages.begin(); it != stages.end(); ++it) {
+            const QJsonObject stage = it.value().toObject();
+            QTextStream(stdout) << QStringLiteral("allocations of %1 %2 per run").arg(it.key(), -16)
+                                       .arg(stage["allocations_per_run"].toDouble(), 10, 'f', 1)
+                                << Qt::endl;
+        }
+    }
+
+    if (parser.isSet(reportOption) && !metrics().writeReport(parser.value(reportOption)))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include "mock_translation_server.h"
+
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include "auto_translator.h"
+
+MockTranslationServer::MockTranslationServer(const MockServerOptions &options)
+    : m_options(options)
+{
+    m_clock.start();
+    QObject::connect(&m_server, &QTcpServer::newConnection, &m_server, [this]() {
+        while (QTcpSocket *socket = m_server.nextPendingConnection()) {
+            QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, socket]() { readRequests(socket); });
+            QObject::connect(socket, &QTcpSocket::disconnected, socket, [this, socket]() {
+                m_buffers.remove(socket);
+                socket->deleteLater();
+            });
+        }
+    });
+}
+
+bool MockTranslationServer::listen()
+{
+    return m_server.listen(QHostAddress::LocalHost);
+}
+
+QUrl MockTranslationServer::endpoint() const
+{
+    return QUrl(QStringLiteral("http://127.0.0.1:%1/v1/chat/completions").arg(m_server.serverPort()));
+}
+
+QStringList MockTranslationServer::phrasesOfRequest(const QJsonObject &request)
+{
+    const QJsonArray messages = request["messages"].toArray();
+    if (messages.isEmpty())
+        return {};
+    const QString prompt = messages.last().toObject()["content"].toString();
+    const QLatin1String marker("Phrases:\n");
+    const int start = int(prompt.indexOf(marker));
+    if (start < 0)
+        return {};
+    const QByteArray list = prompt.mid(start + marker.size()).toUtf8();
+
+    // Structured output requests key the phrases by their position in the batch.
+    if (request.contains("response_format")) {
+        const QJsonObject numbered = QJsonDocument::fromJson(list).object();
+        QStringList phrases(numbered.size());
+        for (auto it = numbered.begin(); it != numbered.end(); ++it) {
+            const int id = it.key().toInt();
+            if (id >= 0 && id < phrases.size())
+                phrases[id] = it.value().toString();
+        }
+        return phrases;
+    }
+    QStringList phrases;
+    for (const QJsonValue &phrase : QJsonDocument::fromJson(list).array())
+        phrases.append(phrase.toString());
+    return phrases;
+}
+
+QByteArray MockTranslationServer::translationContent(const QStringList &phrases, const QString &lang)
+{
+    QJsonArray entries;
+    for (const QString &phrase : phrases) {
+        QJsonObject entry;
+        entry["source"] = phrase;
+        entry["translation"] = QStringLiteral("[%1] %2").arg(lang, phrase);
+        entries.append(entry);
+    }
+    return QJsonDocument(entries).toJson(QJsonDocument::Compact);
+}
+
+QByteArray MockTranslationServer::structuredContent(const QStringList &phrases, const QString &lang)
+{
+    QJsonArray items;
+    for (int i = 0; i < phrases.size(); ++i) {
+        QJsonObject item;
+        item["id"] = i;
+        item["t"] = QStringLiteral("[%1] %2").arg(lang, phrases.at(i));
+        items.append(item);
+    }
+    return QJsonDocument(QJsonObject{{"items", items}}).toJson(QJsonDocument::Compact);
+}
+
+QByteArray MockTranslationServer::completionBody(const QByteArray &content)
+{
+    QJsonObject message;
+    message["role"] = "assistant";
+    message["content"] = QString::fromUtf8(content);
+    QJsonObject choice;
+    choice["index"] = 0;
+    choice["message"] = message;
+    choice["finish_reason"] = "stop";
+    QJsonObject response;
+    response["id"] = "chatcmpl-mock";
+    response["object"] = "chat.completion";
+    response["choices"] = QJsonArray{choice};
+    return QJsonDocument(response).toJson(QJsonDocument::Compact);
+}
+
+QByteArray MockTranslationServer::streamedCompletionBody(const QByteArray &content)
+{
+    // Deltas of a few characters, cut without regard to the JSON structure like real ones.
+    const QString text = QString::fromUtf8(content);
+    QByteArray body;
+    for (int pos = 0; pos < text.size(); pos += 16) {
+        QJsonObject delta;
+        delta["content"] = text.mid(pos, 16);
+        QJsonObject choice;
+        choice["index"] = 0;
+        choice["delta"] = delta;
+        QJsonObject chunk;
+        chunk["object"] = "chat.completion.chunk";
+        chunk["choices"] = QJsonArray{choice};
+        body += "data: " + QJsonDocument(chunk).toJson(QJsonDocument::Compact) + "\n\n";
+    }
+    body += "data: [DONE]\n\n";
+    return body;
+}
+
+void MockTranslationServer::readRequests(QTcpSocket *socket)
+{
+    QByteArray &buffer = m_buffers[socket];
+    buffer += socket->readAll();
+    for (;;) {
+        const int headerEnd = int(buffer.indexOf("\r\n\r\n"));
+        if (headerEnd < 0)
+            return;
+        int contentLength = 0;
+        for (const QByteArray &line : buffer.left(headerEnd).split('\n')) {
+            const int colon = int(line.indexOf(':'));
+            if (colon > 0 && line.left(colon).trimmed().toLower() == "content-length")
+                contentLength = line.mid(colon + 1).trimmed().toInt();
+        }
+        const int bodyStart = headerEnd + 4;
+        if (buffer.size() < bodyStart + contentLength)
+            return;
+        const QByteArray body = buffer.mid(bodyStart, contentLength);
+        buffer.remove(0, bodyStart + contentLength);
+        answer(socket, body);
+    }
+}
+
+void MockTranslationServer::answer(QTcpSocket *socket, const QByteArray &body)
+{
+    if (++m_requests <= m_options.stalledRequests)
+        return;
+    if (m_requests <= m_options.stalledRequests + m_options.failedRequests) {
+        writeResponse(socket, "503 Service Unavailable", "application/json", {},
+                      R"({"error":{"message":"The server is overloaded","type":"server_error"}})");
+        return;
+    }
+    const qint64 now = m_clock.elapsed();
+    while (!m_accepted.isEmpty() && now - m_accepted.head().first >= 60000)
+        m_acceptedTokens -= m_accepted.dequeue().second;
+
+    const QJsonObject request = QJsonDocument::fromJson(body).object();
+    const QJsonArray messages = request["messages"].toArray();
+    const QString prompt = messages.isEmpty() ? QString() : messages.last().toObject()["content"].toString();
+    const int into = int(prompt.indexOf(QLatin1String(" into ")));
+    const QString lang = into < 0 ? QStringLiteral("xx") : prompt.mid(into + 6).section(QLatin1Char(' '), 0, 0);
+    const QStringList phrases = phrasesOfRequest(request);
+
+    QList<QPair<QByteArray, QByteArray>> headers;
+    QByteArray limitedBy;
+    qint64 retryAfter = 0;
+    if (m_options.requestsPerMinute > 0) {
+        const qint64 reset = m_accepted.isEmpty() ? 0 : 60000 - (now - m_accepted.head().first);
+        const bool limited = m_accepted.size() >= m_options.requestsPerMinute;
+        headers.append({"x-ratelimit-limit-requests", QByteArray::number(m_options.requestsPerMinute)});
+        headers.append({"x-ratelimit-reset-requests", QByteArray::number(reset) + "ms"});
+        headers.append({"x-ratelimit-remaining-requests",
+                        QByteArray::number(limited ? 0 : m_options.requestsPerMinute - int(m_accepted.size()) - 1)});
+        if (limited) {
+            limitedBy = "requests";
+            retryAfter = reset;
+        }
+    }
+    // A request larger than the whole limit is let through alone, as the client waits for a full bucket.
+    const int tokens =
+        m_options.tokensPerMinute > 0 ? qMin(estimateBatchTokens(phrases), m_options.tokensPerMinute) : 0;
+    if (m_options.tokensPerMinute > 0) {
+        // The time until enough of the last minute's tokens have expired for this request.
+        qint64 reset = 0;
+        int used = m_acceptedTokens;
+        for (const auto &accepted : std::as_const(m_accepted)) {
+            if (used + tokens <= m_options.tokensPerMinute)
+                break;
+            used -= accepted.second;
+            reset = 60000 - (now - accepted.first);
+        }
+        const bool limited = m_acceptedTokens + tokens > m_options.tokensPerMinute;
+        headers.append({"x-ratelimit-limit-tokens", QByteArray::number(m_options.tokensPerMinute)});
+        headers.append({"x-ratelimit-reset-tokens", QByteArray::number(reset) + "ms"});
+        const int remaining = m_options.tokensPerMinute - m_acceptedTokens - (limited ? 0 : tokens);
+        headers.append({"x-ratelimit-remaining-tokens", QByteArray::number(qMax(0, remaining))});
+        if (limited) {
+            limitedBy = "tokens";
+            retryAfter = qMax(retryAfter, reset);
+        }
+    }
+    if (!limitedBy.isEmpty()) {
+        ++m_rejected;
+        headers.append({"retry-after-ms", QByteArray::number(retryAfter)});
+        writeResponse(socket, "429 Too Many Requests", "application/json", headers,
+                      R"({"error":{"message":"Rate limit reached","type":")" + limitedBy + R"("}})");
+        return;
+    }
+    m_accepted.enqueue({now, tokens});
+    m_acceptedTokens += tokens;
+
+    const QByteArray content = request.contains("response_format") ? structuredContent(phrases, lang)
+                                                                   : translationContent(phrases, lang);
+    const bool stream = request["stream"].toBool();
+
+    QTimer::singleShot(m_options.latencyMs, socket, [socket, headers, content, stream]() {
+        if (stream)
+            writeResponse(socket, "200 OK", "text/event-stream", headers, streamedCompletionBody(content));
+        else
+            writeResponse(socket, "200 OK", "application/json", headers, completionBody(content));
+    });
+}
+
+void MockTranslationServer::writeResponse(QTcpSocket *socket, const QByteArray &status, const QByteArray &contentType,
+                                          const QList<QPair<QByteArray, QByteArray>> &headers, const QByteArray &body)
+{
+    QByteArray response = "HTTP/1.1 " + status + "\r\n";
+    response += "Content-Type: " + contentType + "\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    response += "Connection: keep-alive\r\n";
+    for (const auto &header : headers)
+        response += header.first + ": " + header.second + "\r\n";
+    response += "\r\n";
+    response += body;
+    socket->write(response);
+}
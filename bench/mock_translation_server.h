@@ -0,0 +1,83 @@
+#ifndef MOCK_TRANSLATION_SERVER_H
+#define MOCK_TRANSLATION_SERVER_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonObject>
+#include <QList>
+#include <QPair>
+#include <QQueue>
+#include <QStringList>
+#include <QTcpServer>
+#include <QUrl>
+
+class QTcpSocket;
+
+/// @brief Behaviour of the mock chat completions endpoint.
+struct MockServerOptions {
+    int latencyMs = 50;         ///< Delay before every answer, standing in for model time.
+    int requestsPerMinute = 0;  ///< Requests accepted per sliding minute; more are answered with 429. 0 means unlimited.
+    int tokensPerMinute = 0;    ///< Estimated tokens accepted per sliding minute. 0 means unlimited.
+    int stalledRequests = 0;    ///< Number of first requests that are read but never answered, like a stalled connection.
+    int failedRequests = 0;     ///< Number of requests after the stalled ones that are answered with 503.
+};
+
+/// @brief Local HTTP/1.1 server answering chat completion requests like the API would.
+/// @details Every phrase of a request is answered with a made-up translation, as a plain
+/// completion or as server-sent events if the request asks for a stream, and by ID if the
+/// request has a response_format. Answers carry the x-ratelimit-*-requests and
+/// x-ratelimit-*-tokens headers, and requests over the configured request or token rate are
+/// rejected with 429 and a retry-after-ms header, so that the scheduler and rate limiter run
+/// like against the API. Tokens are counted with estimateBatchTokens(), as the client does.
+/// The first MockServerOptions::stalledRequests requests get no answer at all, and the
+/// MockServerOptions::failedRequests after them fail with a server error.
+/// The server runs in the event loop of the thread it was created in.
+class MockTranslationServer
+{
+public:
+    explicit MockTranslationServer(const MockServerOptions &options);
+
+    /// @brief Starts listening on a free port of the loopback interface.
+    bool listen();
+
+    /// @brief The URL to configure as endpoint.
+    QUrl endpoint() const;
+
+    int requests() const { return m_requests; }
+    int rejected() const { return m_rejected; }
+
+    /// @brief Extracts the phrases of a request body built by ChatCompletionsBackend.
+    /// @details The phrases follow "Phrases:" in the last message as a JSON array, or as a JSON
+    /// object keyed by ID when the request has a response_format.
+    static QStringList phrasesOfRequest(const QJsonObject &request);
+
+    /// @brief The answer content listing a translation for every phrase.
+    static QByteArray translationContent(const QStringList &phrases, const QString &lang);
+
+    /// @brief The structured output answer, {"items": [{"id", "t"}]}, for phrases sent with IDs.
+    static QByteArray structuredContent(const QStringList &phrases, const QString &lang);
+
+    /// @brief A complete (non-streamed) chat completion response with the given content.
+    static QByteArray completionBody(const QByteArray &content);
+
+    /// @brief A server-sent event stream delivering the given content in small deltas.
+    static QByteArray streamedCompletionBody(const QByteArray &content);
+
+private:
+    void readRequests(QTcpSocket *socket);
+    void answer(QTcpSocket *socket, const QByteArray &body);
+    static void writeResponse(QTcpSocket *socket, const QByteArray &status, const QByteArray &contentType,
+                              const QList<QPair<QByteArray, QByteArray>> &headers, const QByteArray &body);
+
+    MockServerOptions m_options;
+    QTcpServer m_server;
+    QHash<QTcpSocket *, QByteArray> m_buffers;
+    QElapsedTimer m_clock;
+    QQueue<QPair<qint64, int>> m_accepted; ///< Acceptance times and tokens within the last minute, oldest first.
+    int m_acceptedTokens = 0;              ///< Sum of the tokens in m_accepted.
+    int m_requests = 0;
+    int m_rejected = 0;
+};
+
+#endif // MOCK_TRANSLATION_SERVER_H
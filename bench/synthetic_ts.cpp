@@ -0,0 +1,88 @@
+#include "synthetic_ts.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QList>
+#include <QRandomGenerator>
+#include <QStringList>
+#include <QXmlStreamWriter>
+
+/// @brief Builds a UI-like phrase; the number keeps phrases distinct unless they are duplicated on purpose.
+static QString syntheticPhrase(QRandomGenerator &rng, int number)
+{
+    static const char *const words[] = {
+        "Open", "Save", "file", "the", "settings", "Cancel", "project", "Export", "selected", "items",
+        "Import", "Delete", "folder", "Show", "hidden", "Apply", "changes", "to", "all", "windows",
+    };
+    const int wordCount = int(sizeof(words) / sizeof(words[0]));
+
+    QStringList parts;
+    const int count = 2 + rng.bounded(7);
+    for (int i = 0; i < count; ++i)
+        parts.append(QLatin1String(words[rng.bounded(wordCount)]));
+    switch (rng.bounded(8)) {
+    case 0:
+        parts.append(QStringLiteral("&& <b>%1</b>"));
+        break;
+    case 1:
+        parts.append(QStringLiteral("\"%1\""));
+        break;
+    default:
+        break;
+    }
+    parts.append(QString::number(number));
+    return parts.join(QLatin1Char(' '));
+}
+
+bool writeSyntheticTs(const QString &filePath, const SyntheticTsOptions &options)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Unable to write synthetic TS file:" << filePath;
+        return false;
+    }
+
+    QRandomGenerator rng(options.seed);
+    QStringList sources;
+
+    QXmlStreamWriter xml(&file);
+    xml.setAutoFormatting(true);
+    xml.writeStartDocument();
+    xml.writeDTD(QStringLiteral("<!DOCTYPE TS>"));
+    xml.writeStartElement(QStringLiteral("TS"));
+    xml.writeAttribute(QStringLiteral("version"), QStringLiteral("2.1"));
+    xml.writeAttribute(QStringLiteral("language"), QStringLiteral("de_DE"));
+
+    for (int c = 0; c < options.contexts; ++c) {
+        xml.writeStartElement(QStringLiteral("context"));
+        xml.writeTextElement(QStringLiteral("name"), QStringLiteral("Module%1Widget").arg(c));
+        for (int m = 0; m < options.messagesPerContext; ++m) {
+            QString source;
+            if (!sources.isEmpty() && rng.generateDouble() < options.duplicateRate)
+                source = sources.at(rng.bounded(int(sources.size())));
+            else
+                source = syntheticPhrase(rng, int(sources.size()));
+            sources.append(source);
+
+            xml.writeStartElement(QStringLiteral("message"));
+            for (int l = 0; l < options.locationsPerMessage; ++l) {
+                xml.writeEmptyElement(QStringLiteral("location"));
+                xml.writeAttribute(QStringLiteral("filename"), QStringLiteral("../src/module%1/widget%2.cpp").arg(c).arg(l));
+                xml.writeAttribute(QStringLiteral("line"), QString::number(10 + m * 7 + l));
+            }
+            xml.writeTextElement(QStringLiteral("source"), source);
+            xml.writeStartElement(QStringLiteral("translation"));
+            if (rng.generateDouble() < options.translatedRate)
+                xml.writeCharacters(QStringLiteral("Übersetzt: ") + source);
+            else
+                xml.writeAttribute(QStringLiteral("type"), QStringLiteral("unfinished"));
+            xml.writeEndElement(); // translation
+            xml.writeEndElement(); // message
+        }
+        xml.writeEndElement(); // context
+    }
+
+    xml.writeEndElement(); // TS
+    xml.writeEndDocument();
+    return !xml.hasError();
+}
@@ -0,0 +1,25 @@
+#ifndef SYNTHETIC_TS_H
+#define SYNTHETIC_TS_H
+
+#include <QString>
+
+/// @brief Shape of a generated TS file.
+struct SyntheticTsOptions {
+    int contexts = 50;            ///< Number of <context> elements.
+    int messagesPerContext = 40;  ///< Number of messages in every context.
+    int locationsPerMessage = 2;  ///< Number of <location> elements of every message.
+    double duplicateRate = 0.3;   ///< Share of messages that repeat the source text of an earlier one.
+    double translatedRate = 0.0;  ///< Share of messages that already carry a finished translation.
+    quint32 seed = 1;             ///< Seed of the generator; equal options produce equal files.
+};
+
+/// @brief Writes a TS file in the format lupdate produces, filled with synthetic messages.
+/// @details Source texts are short UI-like phrases, some with markup and placeholders, so
+/// that escaping and the source index are exercised like with a real project.
+///
+/// @param filePath The TS file to write.
+/// @param options The shape of the file.
+/// @return True if the file was written.
+bool writeSyntheticTs(const QString &filePath, const SyntheticTsOptions &options);
+
+#endif // SYNTHETIC_TS_H
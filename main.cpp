@@ -1,534 +1,169 @@
 #include <QCoreApplication>
 #include <QCommandLineParser>
 #include <QCommandLineOption>
-#include <QDebug>
-#include <QFile>
-#include <QXmlStreamReader>
-#include <QXmlStreamWriter>
-#include <QMap>
-#include <QString>
-#include <QStringList>
-#include <QList>
-#include <QRegularExpression>
-#include <QtNetwork/QNetworkAccessManager>
-#include <QtNetwork/QNetworkRequest>
-#include <QtNetwork/QNetworkReply>
-#include <QSslConfiguration>
-#include <QUrl>
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QJsonArray>
-#include <QEventLoop>
-
-/// @brief Represents a source code location.
-/// @details This structure stores the filename and line number where a particular event occurs.
-struct Location {
-    QString filename; ///< The name of the file where the location is referenced.
-    int line; ///< The line number within the file.
-};
-
-/// @brief Holds information about a translation message.
-/// @details This structure contains details about a message, including its source text,
-/// translation, type, and multiple locations where it appears.
-struct MessageInfo {
-    QList<Location> locations; ///< List of locations where the message is found.
-    QString source; ///< The original text of the message.
-    QString translation; ///< The translated text.
-    QString translationType; ///< The type of translation, e.g., "unfinished".
-};
-
-/// @brief Holds configuration settings for the translation process.
-/// @details This structure stores file paths, API settings, and language options.
-struct Config {
-    QString tsFilePath;    ///< Path to the TS (translation source) file.
-    QString apiKeyPath;    ///< Path to the API key file.
-    int apiCallSize;       ///< Number of phrases per API call batch.
-    QString lang;          ///< Target language for translation.
-    QString langPostfix;   ///< Additional language specification (e.g., TR_tr, RU_ru).
-    QString csvToImport;   ///< If the importFromCSV option is true this file will be imported and written into ts file.
-    QString csvToExport;   ///< If the exportToCSV option is true this file will be written with the original source and translations.
-    bool importFromCSV;    ///< If true the program will read from csv and write into ts. Won't make GPT calls.
-    bool exportToCSV;      ///< If true translations will write into csv file.
-    bool writeBackToTs;    ///< If true the TS file will be overwritten and the translations will be put into place.
-};
-
-/// @brief Parses a TS (Translation Source) file and extracts message information.
-/// @details This function reads an XML-based TS file and maps context names to lists of messages.
-/// Each message includes source text, translation, translation type, and location data.
-///
-/// @param filePath The path to the TS file to be parsed.
-/// @return A QMap where keys are context names and values are lists of MessageInfo structures.
-QMap<QString, QList<MessageInfo>> parseTsFile(const QString &filePath)
-{
-    QMap<QString, QList<MessageInfo>> contextMap;
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        qWarning() << "Unable to open file:" << filePath;
-        return contextMap;
-    }
-    QXmlStreamReader xml(&file);
-    QString contextName;
-
-    while (!xml.atEnd() && !xml.hasError()) {
-        QXmlStreamReader::TokenType token = xml.readNext();
-        if (token == QXmlStreamReader::StartElement) {
-            if (xml.name() == QLatin1String("context")) {
-                contextName.clear();
-                QList<MessageInfo> messages;
-                while (!(xml.tokenType() == QXmlStreamReader::EndElement && xml.name() == QLatin1String("context"))) {
-                    if (xml.tokenType() == QXmlStreamReader::StartElement) {
-                        if (xml.name() == QLatin1String("name")) {
-                            contextName = xml.readElementText();
-                        } else if (xml.name() == QLatin1String("message")) {
-                            MessageInfo msg;
-                            while (!(xml.tokenType() == QXmlStreamReader::EndElement && xml.name() == QLatin1String("message"))) {
-                                if (xml.tokenType() == QXmlStreamReader::StartElement) {
-                                    if (xml.name() == QLatin1String("location")) {
-                                        QXmlStreamAttributes attrs = xml.attributes();
-                                        Location loc;
-                                        loc.filename = attrs.value("filename").toString();
-                                        loc.line = attrs.value("line").toInt();
-                                        msg.locations.append(loc);
-                                        xml.skipCurrentElement();
-                                    } else if (xml.name() == QLatin1String("source")) {
-                                        msg.source = xml.readElementText();
-                                    } else if (xml.name() == QLatin1String("translation")) {
-                                        QXmlStreamAttributes attrs = xml.attributes();
-                                        msg.translationType = attrs.value("type").toString();
-                                        msg.translation = xml.readElementText();
-                                    }
-                                }
-                                xml.readNext();
-                            }
-                            messages.append(msg);
-                        }
-                    }
-                    xml.readNext();
-                }
-                if (!contextName.isEmpty())
-                    contextMap.insert(contextName, messages);
-            }
-        }
-    }
-    if (xml.hasError())
-        qWarning() << "XML Parsing Error:" << xml.errorString();
-    file.close();
-    return contextMap;
-}
 
-/// @brief Writes updated translations to a TS (Translation Source) file.
-/// @details This function takes a mapping of context names to message lists and writes them
-/// into an XML-based TS file. It preserves structure, including context names, message sources,
-/// translations, and locations.
-///
-/// @param filePath The path to the TS file to be written.
-/// @param translations A QMap where keys are context names and values are lists of MessageInfo structures.
-/// @return True if the file was successfully written, false otherwise.
-bool writeTsFile(const QString &filePath, const QMap<QString, QList<MessageInfo>> &translations)
+#include "auto_translator.h"
+
+/// @brief Formats a duration in milliseconds as h:mm:ss.
+static QString formatDuration(qint64 ms)
 {
-    QFile file(filePath);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        qWarning() << "Unable to open file for writing:" << filePath;
-        return false;
-    }
-    QXmlStreamWriter writer(&file);
-    writer.setAutoFormatting(true);
-    writer.writeStartDocument();
-    writer.writeDTD("<!DOCTYPE TS>");
-    writer.writeStartElement("TS");
-    writer.writeAttribute("version", "2.1");
-    writer.writeAttribute("language", "en_US"); // Adjust if needed.
-
-    // Iterate over contexts.
-    for (auto contextIt = translations.constBegin(); contextIt != translations.constEnd(); ++contextIt) {
-        writer.writeStartElement("context");
-        writer.writeTextElement("name", contextIt.key());
-        // Iterate over messages.
-        for (const MessageInfo &msg : contextIt.value()) {
-            writer.writeStartElement("message");
-            // Write each location.
-            for (const Location &loc : msg.locations) {
-                writer.writeEmptyElement("location");
-                writer.writeAttribute("filename", loc.filename);
-                writer.writeAttribute("line", QString::number(loc.line));
-            }
-            writer.writeTextElement("source", msg.source);
-            writer.writeStartElement("translation");
-            // Set type attribute if translation is still empty.
-            if (msg.translation.isEmpty())
-                writer.writeAttribute("type", "unfinished");
-            writer.writeCharacters(msg.translation);
-            writer.writeEndElement(); // </translation>
-            writer.writeEndElement(); // </message>
-        }
-        writer.writeEndElement(); // </context>
-    }
-    writer.writeEndElement(); // </TS>
-    writer.writeEndDocument();
-    file.close();
-    return true;
+    const qint64 seconds = (ms + 999) / 1000;
+    return QStringLiteral("%1:%2:%3")
+        .arg(seconds / 3600)
+        .arg(seconds / 60 % 60, 2, 10, QLatin1Char('0'))
+        .arg(seconds % 60, 2, 10, QLatin1Char('0'));
 }
 
-/// @brief Reads an API key from a specified file.
-/// @details This function opens a file containing the API key as plain text, reads its contents,
-/// and trims any extraneous whitespace or UTF-8 BOM if present.
-///
-/// @param apiKeyPath The path to the file containing the API key.
-/// @return The API key as a QString, or an empty string if the file could not be read.
-bool exportToCsv(const QString &csvFilePath, const QMap<QString, QList<MessageInfo>> &translations)
+/// @brief Prints what the run would send to the primary backend, for --plan.
+static void printPlan(const Config &config, const QList<LanguageJob> &jobs,
+                      const QList<QList<QStringList>> &batchesPerJob, int cacheHits, int cacheMisses)
 {
-    QFile file(csvFilePath);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        qWarning() << "Cannot open CSV file for writing:" << csvFilePath;
-        return false;
-    }
-    QTextStream out(&file);
-    // Write header (you can adjust the header order if desired).
-    out << "source,translation,translationType,locations\n";
-
-    // Helper lambda to escape a CSV field.
-    auto escapeCsvField = [](const QString &field) -> QString {
-        QString result = field;
-        if (result.contains(QLatin1Char(',')) ||
-            result.contains(QLatin1Char('"')) ||
-            result.contains('\n'))
-        {
-            result.replace("\"", "\"\"");
-            result = "\"" + result + "\"";
-        }
-        return result;
+    const BackendConfig &backend = config.backends.first();
+    auto cost = [&backend](qint64 input, qint64 output) {
+        return input / 1e6 * backend.inputCostPerMillion + output / 1e6 * backend.outputCostPerMillion;
     };
 
-    // Iterate over each context and its messages.
-    for (auto contextIt = translations.constBegin(); contextIt != translations.constEnd(); ++contextIt) {
-        const QList<MessageInfo> &messages = contextIt.value();
-        for (const MessageInfo &msg : messages) {
-            // Build a string for the locations.
-            QStringList locs;
-            for (const Location &loc : msg.locations) {
-                locs << QString("%1:%2").arg(loc.filename).arg(loc.line);
-            }
-            QString locationsStr = locs.join("; ");
-
-            // Write the CSV row.
-            out << escapeCsvField(msg.source) << ","
-                << escapeCsvField(msg.translation) << ","
-                << escapeCsvField(msg.translationType) << ","
-                << escapeCsvField(locationsStr) << "\n";
+    QTextStream out(stdout);
+    QList<QStringList> allBatches;
+    qint64 totalInput = 0;
+    qint64 totalOutput = 0;
+    int totalPhrases = 0;
+    for (int i = 0; i < jobs.size(); ++i) {
+        const QList<QStringList> &batches = batchesPerJob.at(i);
+        qint64 input = 0;
+        qint64 output = 0;
+        int phrases = 0;
+        for (const QStringList &batch : batches) {
+            input += estimatePromptTokens(batch);
+            output += estimateCompletionTokens(batch);
+            phrases += int(batch.size());
         }
+        out << QStringLiteral("%1 (%2): %3 phrases in %4 requests, ~%5 input and ~%6 output tokens, ~%7")
+                   .arg(jobs.at(i).target.lang, jobs.at(i).target.langPostfix)
+                   .arg(phrases)
+                   .arg(batches.size())
+                   .arg(input)
+                   .arg(output)
+                   .arg(cost(input, output), 0, 'f', 2)
+            << Qt::endl;
+        allBatches.append(batches);
+        totalInput += input;
+        totalOutput += output;
+        totalPhrases += phrases;
     }
-    file.close();
-    return true;
-}
 
-/// @brief Parses a single CSV line into a list of fields.
-/// @details This function supports quoted fields, handling escaped quotes within them.
-/// Fields are separated by commas.
-///
-/// @param line A single CSV line as a QString.
-/// @return A QStringList containing the parsed fields.
-QStringList parseCsvLine(const QString &line)
-{
-    QStringList result;
-    QString field;
-    bool inQuotes = false;
-    for (int i = 0; i < line.length(); ++i) {
-        QChar c = line.at(i);
-        if (inQuotes) {
-            if (c == '"') {
-                // Look ahead for an escaped quote.
-                if (i + 1 < line.length() && line.at(i + 1) == '"') {
-                    field.append('"');
-                    ++i;
-                } else {
-                    inQuotes = false;
-                }
-            } else {
-                field.append(c);
-            }
-        } else {
-            if (c == '"') {
-                inQuotes = true;
-            } else if (c == ',') {
-                result.append(field);
-                field.clear();
-            } else {
-                field.append(c);
-            }
-        }
+    out << QStringLiteral("Total: %1 phrases in %2 requests, ~%3 input and ~%4 output tokens, ~%5")
+               .arg(totalPhrases)
+               .arg(allBatches.size())
+               .arg(totalInput)
+               .arg(totalOutput)
+               .arg(cost(totalInput, totalOutput), 0, 'f', 2)
+        << Qt::endl;
+    out << QStringLiteral("Expected duration: %1 at %2 concurrent requests, %3 RPM, %4 TPM on %5")
+               .arg(formatDuration(estimateDurationMs(allBatches, backend, config.planTokensPerSecond)))
+               .arg(backend.maxConcurrentRequests)
+               .arg(backend.requestsPerMinute > 0 ? QString::number(backend.requestsPerMinute) : QStringLiteral("unlimited"))
+               .arg(backend.tokensPerMinute > 0 ? QString::number(backend.tokensPerMinute) : QStringLiteral("unlimited"))
+               .arg(backend.name)
+        << Qt::endl;
+    if (cacheHits + cacheMisses > 0) {
+        out << QStringLiteral("Translation memory: %1 hits, %2 misses, %3% hit ratio")
+                   .arg(cacheHits)
+                   .arg(cacheMisses)
+                   .arg(100.0 * cacheHits / (cacheHits + cacheMisses), 0, 'f', 1)
+            << Qt::endl;
     }
-    result.append(field);
-    return result;
 }
 
-/// @brief Imports translations from a CSV file and updates the translation map.
-/// @details This function reads a CSV file containing translation data and updates
-/// the provided QMap of translations. The CSV format is expected to have at least
-/// four columns: source text, translation, translation type, and locations.
-/// Locations are expected in the format "filename:line", separated by semicolons.
-///
-/// @param csvFilePath The path to the CSV file to import.
-/// @param translations A reference to a QMap where keys are context names and values
-///                     are lists of MessageInfo structures. The function updates
-///                     the translation fields of the messages.
-/// @return True if the CSV file was successfully read and processed, false otherwise.
-bool importFromCsv(const QString &csvFilePath, QMap<QString, QList<MessageInfo>> &translations)
+/// @brief Serves what the translation memory knows and packs the rest into batches, per language.
+/// @param sourceGroups The sources to translate, grouped by context, see collectSourcesByContext().
+/// @param memory The translation memory, or null if none is used.
+/// @param models The models whose stored translations are accepted.
+/// @return The batches of every job, in the order of @p jobs.
+static QList<QList<QStringList>> buildBatches(const Config &config, QList<LanguageJob> &jobs,
+                                              const QList<QStringList> &sourceGroups, TranslationMemory *memory,
+                                              const QStringList &models)
 {
-    QFile file(csvFilePath);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        qWarning() << "Cannot open CSV file for reading:" << csvFilePath;
-        return false;
-    }
-    QTextStream in(&file);
-    // Read header line and ignore.
-    if (!in.atEnd())
-        in.readLine();
-
-    while (!in.atEnd()) {
-        QString line = in.readLine();
-        if (line.trimmed().isEmpty())
-            continue;
-
-        QStringList fields = parseCsvLine(line);
-        if (fields.size() < 4) {
-            qWarning() << "Invalid CSV line (not enough fields):" << line;
-            continue;
-        }
-
-        QString source = fields[0];
-        QString translation = fields[1].trimmed();
-        QString translationType = fields[2];
-        QString locationsStr = fields[3];
-
-        // If there's no translation provided, skip this row.
-        if (translation.isEmpty())
-            continue;
-
-        // Parse the locations (expecting format "filename:line" separated by semicolons).
-        QList<Location> newLocations;
-        QStringList locList = locationsStr.split(";", Qt::SkipEmptyParts);
-        for (QString locStr : locList) {
-            locStr = locStr.trimmed();
-            int colonIndex = locStr.lastIndexOf(':');
-            if (colonIndex != -1) {
-                QString filename = locStr.left(colonIndex).trimmed();
-                bool ok = false;
-                int lineNumber = locStr.mid(colonIndex + 1).trimmed().toInt(&ok);
-                if (ok) {
-                    newLocations.append({filename, lineNumber});
-                }
-            }
-        }
-
-        // For each matching message (by source text), update translation details.
-        for (auto contextIt = translations.begin(); contextIt != translations.end(); ++contextIt) {
-            QList<MessageInfo> &messages = contextIt.value();
-            for (MessageInfo &msg : messages) {
-                if (msg.source == source) {
-                    msg.translation = translation;
-                    msg.translationType = translationType;
-                    // Optionally update locations if desired.
-                    msg.locations = newLocations;
-                }
+    StageTimer timer(QStringLiteral("batch building"));
+    QList<QList<QStringList>> batchesPerJob;
+    for (LanguageJob &job : jobs) {
+        // Serve what the translation memory already knows without a request.
+        QList<QStringList> misses;
+        int missCount = 0;
+        for (const QStringList &group : sourceGroups) {
+            QStringList groupMisses;
+            for (const QString &source : group) {
+                QString translation;
+                if (!needsTranslation(job, source))
+                    continue;
+                if (memory && memory->lookup(source, job.target.lang, models, &translation))
+                    applyTranslation(job, source, translation);
+                else
+                    groupMisses.append(source);
             }
+            missCount += groupMisses.size();
+            if (!groupMisses.isEmpty())
+                misses.append(groupMisses);
         }
+        batchesPerJob.append(packGroupedBatches(misses, config.maxTokensPerRequest, config.apiCallSize));
+        qDebug() << job.target.lang << "phrases to send:" << missCount << "batches:" << batchesPerJob.last().size();
     }
-    file.close();
-    return true;
-}
-
-
-/// @brief Reads an API key from a specified file.
-/// @details This function opens a file containing the API key as plain text, reads its contents,
-/// and trims any extraneous whitespace or UTF-8 BOM if present.
-///
-/// @param apiKeyPath The path to the file containing the API key.
-/// @return The API key as a QString, or an empty string if the file could not be read.
-QString readApiKeyFromFile(const QString &apiKeyPath)
-{
-    QFile keyFile(apiKeyPath);
-    if (!keyFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        qWarning() << "Unable to open API key file:" << apiKeyPath;
-        return QString();
-    }
-
-    QByteArray raw = keyFile.readAll();
-    if (raw.startsWith("\xEF\xBB\xBF")) {
-        raw.remove(0, 3);
-    }
-    QString key = QString::fromUtf8(raw).trimmed();
-    keyFile.close();
-    return key;
+    return batchesPerJob;
 }
 
-/// @brief Sends a batch of phrases to the GPT API for translation.
-/// @details This function constructs a request to the GPT API, formatting the phrases as a prompt.
-/// The API response is expected to be a JSON array of objects with source and translated text.
-///
-/// @param phrases A list of phrases to be translated.
-/// @param apiKey The API key used for authentication.
-/// @param lang The target language for translation.
-/// @param langPostfix (EN_en, TR_tr ...)
-/// @return The raw response data from the API as a QByteArray, or an empty QByteArray if an error occurs.
-QByteArray sendTranslationBatch(const QStringList &phrases, const QString &apiKey,
-                                const QString &lang, const QString &langPostfix)
+/// @brief Sends the batches of all languages and waits until every answer is applied.
+/// @details The languages are interleaved so that all of them progress at the same pace.
+static void sendBatches(const Config &config, const QList<TranslationBackend *> &backends, QList<LanguageJob> &jobs,
+                        const QList<QList<QStringList>> &batchesPerJob, TranslationMemory *memory,
+                        CheckpointJournal *journal)
 {
-    // Build the prompt by listing the phrases (each on a new line).
-    QString prompt = QString("Translate the following phrases into %1 (%2). Return only a JSON array of objects "
-                             "in the format [{\"source\": \"<original>\", \"translation\": \"<translated>\"}].\nPhrases:\n%3")
-                         .arg(lang).arg(langPostfix)
-                         .arg(phrases.join("\n"));
-
-    QJsonObject requestBody;
-    requestBody["model"] = "gpt-4o-mini";
-
-    QJsonArray messages;
-    {
-        QJsonObject systemMsg;
-        systemMsg["role"] = "system";
-        systemMsg["content"] = "You are a translation assistant.";
-        messages.append(systemMsg);
-    }
-    {
-        QJsonObject userMsg;
-        userMsg["role"] = "user";
-        userMsg["content"] = prompt;
-        messages.append(userMsg);
-    }
-    requestBody["messages"] = messages;
-    requestBody["temperature"] = 0;
-
-    QJsonDocument jsonDoc(requestBody);
-    QByteArray postData = jsonDoc.toJson();
-
-    QNetworkRequest request(QUrl("https://api.openai.com/v1/chat/completions"));
-    request.setAttribute(QNetworkRequest::Http2AllowedAttribute, false);
-    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    request.setRawHeader("Authorization", QString("Bearer %1").arg(apiKey).toUtf8());
-    request.setRawHeader("User-Agent", "QtGPTTranslator/1.0");
-
-    QSslConfiguration sslConfig = QSslConfiguration::defaultConfiguration();
-    sslConfig.setProtocol(QSsl::TlsV1_2OrLater);
-    request.setSslConfiguration(sslConfig);
-
-    qDebug() << "Sending request";
-    QNetworkAccessManager networkManager;
-    QNetworkReply *reply = networkManager.post(request, postData);
-
-    QEventLoop eventLoop;
-    QObject::connect(reply, &QNetworkReply::finished, &eventLoop, &QEventLoop::quit);
-    eventLoop.exec();
-
-    if (reply->error() != QNetworkReply::NoError) {
-        qWarning() << "Network error:" << reply->errorString();
-        reply->deleteLater();
-        return QByteArray();
+    BatchScheduler scheduler(config, backends, memory, journal);
+    for (int round = 0, added = 1; added > 0; ++round) {
+        added = 0;
+        for (int i = 0; i < jobs.size(); ++i) {
+            if (round < batchesPerJob.at(i).size()) {
+                scheduler.addBatch(batchesPerJob.at(i).at(round), &jobs[i]);
+                ++added;
+            }
+        }
     }
-
-    QByteArray responseData = reply->readAll();
-    reply->deleteLater();
-    return responseData;
+    StageTimer timer(QStringLiteral("network"));
+    scheduler.run();
 }
 
-/// @brief Processes an API response and updates the translation map.
-/// @details This function parses the JSON response from the GPT API, extracts translations,
-/// and updates the corresponding messages in the provided translation map.
-///
-/// @param responseData The raw API response data as a QByteArray.
-/// @param translations A reference to a QMap where keys are context names and values are lists of MessageInfo.
-///                     The function updates the translation fields of the messages.
-void processResponse(const QByteArray &responseData, QMap<QString, QList<MessageInfo>> &translations)
+/// @brief Writes the TS and CSV outputs of the given files in parallel.
+/// @return True if every output was written.
+static bool writeOutputs(const Config &config, const QList<const TsFileJob *> &outputs)
 {
-    if (responseData.isEmpty())
-        return;
+    const QList<bool> results = QtConcurrent::blockingMapped<QList<bool>>(outputs, [&config](const TsFileJob *file) {
+        // Write the updated translations back to the TS file.
+        if (config.writeBackToTs) {
+            StageTimer timer(QStringLiteral("ts write"));
+            const bool written = config.incrementalWrite
+                                     ? writeTsFileIncremental(file->sourcePath, file->tsFilePath, file->catalog)
+                                     : writeTsFile(file->tsFilePath, file->catalog);
+            if (!written) {
+                qCritical() << "Failed to write back to TS file:" << file->tsFilePath;
+                return false;
+            }
+        }
 
-    QJsonDocument responseDoc = QJsonDocument::fromJson(responseData);
-    if (responseDoc.isNull() || !responseDoc.isObject()) {
-        qWarning() << "Failed to parse API response as JSON.";
-        return;
-    }
-    QJsonObject responseObj = responseDoc.object();
-    QJsonArray choices = responseObj["choices"].toArray();
-    if (choices.isEmpty()) {
-        qWarning() << "No choices returned from API.";
-        return;
-    }
-    QJsonObject firstChoice = choices.first().toObject();
-    QJsonObject messageObj = firstChoice["message"].toObject();
-    QString content = messageObj["content"].toString();
-
-    // Remove code block markers if present.
-    QRegularExpression codeBlockRegex("```(?:json)?\\s*([\\s\\S]*?)\\s*```");
-    QRegularExpressionMatch match = codeBlockRegex.match(content);
-    if (match.hasMatch())
-        content = match.captured(1);
-
-    QJsonDocument parsedContent = QJsonDocument::fromJson(content.toUtf8());
-    if (parsedContent.isNull() || !parsedContent.isArray()) {
-        qWarning() << "Failed to parse the returned translation JSON.";
-        return;
-    }
-    QJsonArray translationsArray = parsedContent.array();
-
-    // Build a mapping from source to translation.
-    QMap<QString, QString> translationMapping;
-    for (const QJsonValue &val : translationsArray) {
-        if (val.isObject()) {
-            QJsonObject obj = val.toObject();
-            QString source = obj["source"].toString();
-            QString translation = obj["translation"].toString();
-            if (!source.isEmpty())
-                translationMapping.insert(source, translation);
+        // Export to csv to CSV if wanted
+        if(config.exportToCSV){
+            StageTimer timer(QStringLiteral("csv export"));
+            exportToCsv(file->csvToExport, file->catalog, config.exportChangedOnly);
         }
-    }
 
-    // Update the context map with the translations.
-    for (auto &messages : translations) {
-        for (auto &msg : messages) {
-            if (translationMapping.contains(msg.source))
-                msg.translation = translationMapping.value(msg.source);
+        // Keep the state for the next run, stamped with the TS file as it is now.
+        if (!file->snapshotPath.isEmpty()) {
+            StageTimer timer(QStringLiteral("snapshot write"));
+            writeCatalogSnapshot(file->snapshotPath, file->catalog, file->sourcePath);
         }
-    }
+        return true;
+    });
+    return !results.contains(false);
 }
 
-/// @brief Loads configuration settings from a JSON file.
-/// @details This function reads a JSON configuration file, parses its content,
-/// and populates a Config structure with the extracted values.
-/// Exits the program if the configuration file is missing or invalid.
-///
-/// @param configPath The path to the configuration file.
-/// @return A Config structure populated with the loaded settings.
-Config loadConfig(const QString &configPath) {
-    QFile configFile(configPath);
-    if (!configFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        qCritical() << "Config dosyası açılamadı!";
-        exit(1);
-    }
-
-    QByteArray jsonData = configFile.readAll();
-    configFile.close();
-
-    QJsonDocument jsonDoc = QJsonDocument::fromJson(jsonData);
-    if (!jsonDoc.isObject()) {
-        qCritical() << "Config dosyası geçersiz!";
-        exit(1);
-    }
-
-    QJsonObject jsonObj = jsonDoc.object();
-    Config config;
-    config.tsFilePath    = jsonObj["ts_file_path"].toString();
-    config.apiKeyPath    = jsonObj["api_key_path"].toString();
-    config.apiCallSize   = jsonObj["api_call_size"].toInt(50);
-    config.lang          = jsonObj["lang"].toString();
-    config.langPostfix   = jsonObj["lang_postfix"].toString();
-    config.csvToExport   = jsonObj["csv_to_export"].toString();
-    config.csvToImport   = jsonObj["csv_to_import"].toString();
-    config.exportToCSV   = jsonObj["export_to_csv"].toBool();
-    config.importFromCSV = jsonObj["import_from_csv"].toBool();
-    config.writeBackToTs = jsonObj["write_back_to_ts"].toBool();
-
-    return config;
-}
 //---------------------------------------------------------------------
 // Main function
 int main(int argc, char *argv[]) {
@@ -546,8 +181,17 @@ int main(int argc, char *argv[]) {
                                         "config_path",
                                         "config.json");
 
+    QCommandLineOption planOption("plan",
+                                  "Print the requests, tokens, cost and duration of the run without sending anything.");
+    QCommandLineOption watchOption("watch",
+                                   "Keep running and translate what is added to the TS files whenever they change.");
+
     parser.addOption(configPathOption);
+    parser.addOption(planOption);
+    parser.addOption(watchOption);
     parser.process(app);
+    const bool plan = parser.isSet(planOption);
+    const bool watch = parser.isSet(watchOption) && !plan;
 
     QString configPath = parser.value(configPathOption);
     Config config = loadConfig(configPath);
@@ -555,59 +199,253 @@ int main(int argc, char *argv[]) {
     qDebug() << "TS File Path:" << config.tsFilePath;
     qDebug() << "API Key Path:" << config.apiKeyPath;
     qDebug() << "API Call Size:" << config.apiCallSize;
-    qDebug() << "Language:" << config.lang;
-    qDebug() << "Language Postfix:" << config.langPostfix;
+    qDebug() << "Max Tokens Per Request:" << config.maxTokensPerRequest;
+    for (const TranslationTarget &target : config.targets)
+        qDebug() << "Target:" << target.lang << target.langPostfix << "->" << target.tsFilePath;
+    for (const BackendConfig &backend : config.backends) {
+        qDebug() << "Backend:" << backend.name << backend.endpoint << "Model:" << backend.model
+                 << "Max Concurrent Requests:" << backend.maxConcurrentRequests << "HTTP/2:" << backend.http2
+                 << "Streaming:" << backend.stream << "Structured Output:" << backend.structuredOutput
+                 << "Rate Limits (RPM/TPM):" << backend.requestsPerMinute << backend.tokensPerMinute;
+    }
+    qDebug() << "Translation Memory:" << config.translationMemoryPath;
+    qDebug() << "Checkpoint Journal:" << config.checkpointPath;
+    qDebug() << "Metrics Report:" << config.metricsReportPath;
+    qDebug() << "Translate Types:" << config.translateTypes << "Context Priority:" << config.contextPriority;
+    qDebug() << "Glossary:" << config.glossaryPath;
+
+    if (watch && config.importFromCSV) {
+        qCritical() << "Watch mode translates through the API and cannot be combined with import_from_csv.";
+        return 1;
+    }
 
-    // Read the API key.
-    QString apiKey = readApiKeyFromFile(config.apiKeyPath);
-    if (apiKey.isEmpty()) {
-        qCritical() << "API key is empty or could not be read.";
+    Glossary glossary;
+    if (!config.glossaryPath.isEmpty() && !glossary.load(config.glossaryPath)) {
+        qCritical() << "Glossary could not be loaded:" << config.glossaryPath;
         return 1;
     }
 
-    // Parse the TS file.
-    QMap<QString, QList<MessageInfo>> translations = parseTsFile(config.tsFilePath);
+    // Read the API keys and set up the backends in fallback order.
+    QList<QSharedPointer<TranslationBackend>> backends;
+    QList<TranslationBackend *> backendOrder;
+    QStringList models;
+    for (const BackendConfig &backendConfig : config.backends) {
+        QString apiKey;
+        if (!plan && !backendConfig.apiKeyPath.isEmpty()) {
+            apiKey = readApiKeyFromFile(backendConfig.apiKeyPath);
+            if (apiKey.isEmpty()) {
+                qCritical() << "API key is empty or could not be read:" << backendConfig.apiKeyPath;
+                return 1;
+            }
+        }
+        backends.append(QSharedPointer<TranslationBackend>(new ChatCompletionsBackend(backendConfig, apiKey, &glossary)));
+        backendOrder.append(backends.last().data());
+        models.append(backendConfig.model);
+    }
+    TranslationBackend &primary = *backendOrder.first();
+
+    // Open the API connection while the TS file is being parsed. With a translation memory
+    // the connection is only opened once it is known that something has to be sent.
+    if (!plan && !config.importFromCSV && config.translationMemoryPath.isEmpty())
+        primary.warmUp();
 
+    // The TS path may name a directory or a glob of TS files; they are translated together.
+    const QStringList tsFiles = expandTsFilePaths(config.tsFilePath);
+    if (tsFiles.isEmpty()) {
+        qCritical() << "No TS files found at:" << config.tsFilePath;
+        return 1;
+    }
+    const bool multiFile = tsFiles.size() > 1 || tsFiles.first() != config.tsFilePath;
+    qDebug() << "TS Files:" << tsFiles.size();
+
+    // Parse every TS file once, in parallel; every language starts from its own copies.
+    const TsReadMode readMode = config.parallelParse ? TsReadMode::Parallel
+                                : config.mmapTs      ? TsReadMode::Mapped
+                                                     : TsReadMode::Stream;
+    const QStringList translateTypes = config.translateTypes;
+    auto parseFile = [readMode, translateTypes](const QString &path) {
+        Catalog catalog;
+        {
+            StageTimer timer(QStringLiteral("parse"));
+            catalog = parseTsFile(path, readMode);
+        }
+        StageTimer timer(QStringLiteral("index"));
+        catalog.buildSourceIndex();
+        selectMessages(catalog, translateTypes);
+        return catalog;
+    };
+    QList<LanguageJob> jobs(config.targets.size());
+    QList<TsFileJob *> files;
+    for (int i = 0; i < jobs.size(); ++i) {
+        jobs[i].target = config.targets.at(i);
+        for (int f = 0; f < tsFiles.size(); ++f)
+            jobs[i].files.append(resolveTsFileJob(config, jobs[i].target, tsFiles.at(f), multiFile));
+        for (TsFileJob &file : jobs[i].files)
+            files.append(&file);
+    }
+
+    // Reload the state of earlier runs from their snapshots, as long as the TS file did not
+    // change since. Messages such a run already changed are not picked again.
+    const QList<bool> restored = QtConcurrent::blockingMapped<QList<bool>>(files, [&translateTypes](TsFileJob *file) {
+        if (file->snapshotPath.isEmpty() || !QFileInfo::exists(file->snapshotPath))
+            return false;
+        StageTimer timer(QStringLiteral("snapshot load"));
+        if (!readCatalogSnapshot(file->snapshotPath, file->catalog, file->sourcePath))
+            return false;
+        file->catalog.buildSourceIndex();
+        selectMessages(file->catalog, translateTypes);
+        for (MessageInfo &msg : file->catalog.messages())
+            msg.pending = msg.pending && !msg.isModified();
+        return true;
+    });
+
+    // Only the TS files some language has no snapshot of are parsed.
+    QStringList toParse;
+    for (int f = 0; f < tsFiles.size(); ++f) {
+        for (int i = 0; i < jobs.size(); ++i) {
+            if (!restored.at(i * tsFiles.size() + f)) {
+                toParse.append(tsFiles.at(f));
+                break;
+            }
+        }
+    }
+    qDebug() << "Snapshots restored:" << restored.count(true) << "TS files to parse:" << toParse.size();
+    const QList<Catalog> parsed = QtConcurrent::blockingMapped<QList<Catalog>>(toParse, parseFile);
+    for (int i = 0; i < files.size(); ++i) {
+        if (!restored.at(i))
+            files[i]->catalog = parsed.at(toParse.indexOf(files.at(i)->sourcePath));
+    }
+    QList<Catalog> catalogs;
+    for (const TsFileJob *file : std::as_const(files))
+        catalogs.append(file->catalog);
+
+    CheckpointJournal journal;
+    TranslationMemory memory;
+    bool useMemory = false;
+    if (plan && config.importFromCSV) {
+        QTextStream(stdout) << "CSV import runs send no requests." << Qt::endl;
+        return 0;
+    }
     if(config.importFromCSV){
-        importFromCsv(config.csvToImport,translations);
+        for (LanguageJob &job : jobs) {
+            for (TsFileJob &file : job.files) {
+                StageTimer timer(QStringLiteral("csv import"));
+                importFromCsv(file.csvToImport, file.catalog);
+            }
+        }
     }
     else{
-        // Batch processing: accumulate untranslated source phrases.
-        QStringList batchPhrases;
-
-        // Iterate over each context and its messages.
-        for (auto contextIt = translations.begin(); contextIt != translations.end(); ++contextIt) {
-            QList<MessageInfo> &messages = contextIt.value();
-            for (MessageInfo &msg : messages) {
-                if (!msg.source.isEmpty() && msg.translation.isEmpty()) {
-                    batchPhrases.append(msg.source);
-                    if (batchPhrases.size() >= config.apiCallSize) {
-                        QByteArray responseData = sendTranslationBatch(batchPhrases, apiKey, config.lang, config.langPostfix);
-                        processResponse(responseData, translations);
-                        batchPhrases.clear();
-                    }
-                }
-            }
+        // Batch processing: send every unique untranslated source of all files exactly once per
+        // language, grouped by context and in context priority order.
+        const QList<QStringList> sourceGroups = collectSourcesByContext(catalogs, config.contextPriority);
+        int sourceCount = 0;
+        for (const QStringList &group : sourceGroups)
+            sourceCount += group.size();
+        qDebug() << "Unique phrases to translate:" << sourceCount << "in" << sourceGroups.size() << "context groups";
+
+        // Resume an interrupted run from its journal. A plan only reads journals and
+        // translation memories that exist, it does not create or write them.
+        if (!config.checkpointPath.isEmpty() && (!plan || QFileInfo::exists(config.checkpointPath))) {
+            if (journal.open(config.checkpointPath, plan))
+                qDebug() << "Checkpoint entries replayed:" << journal.replay(jobs);
+            else
+                qWarning() << "Continuing without checkpoint journal.";
         }
 
-        // Process any remaining phrases.
-        if (!batchPhrases.isEmpty()) {
-            QByteArray responseData = sendTranslationBatch(batchPhrases, apiKey, config.lang, config.langPostfix);
-            processResponse(responseData, translations);
-            batchPhrases.clear();
+        useMemory = !config.translationMemoryPath.isEmpty()
+                    && (!plan || QFileInfo::exists(config.translationMemoryPath))
+                    && memory.open(config.translationMemoryPath, plan);
+        const QList<QList<QStringList>> batchesPerJob =
+            buildBatches(config, jobs, sourceGroups, useMemory ? &memory : nullptr, models);
+        int totalBatches = 0;
+        for (const QList<QStringList> &batches : batchesPerJob)
+            totalBatches += batches.size();
+        if (useMemory) {
+            qDebug() << "Translation memory hits:" << memory.hits() << "misses:" << memory.misses();
+            metrics().setCache(memory.hits(), memory.misses());
         }
-    }
+        if (plan) {
+            printPlan(config, jobs, batchesPerJob, memory.hits(), memory.misses());
+            return 0;
+        }
+        if ((!config.translationMemoryPath.isEmpty() && totalBatches > 0) || watch)
+            primary.warmUp();
 
-    // Write the updated translations back to the TS file.
-    if (config.writeBackToTs && !writeTsFile(config.tsFilePath, translations)) {
-        qCritical() << "Failed to write back to TS file.";
-        return 1;
+        sendBatches(config, backendOrder, jobs, batchesPerJob, useMemory ? &memory : nullptr, &journal);
     }
 
-    // Export to csv to CSV if wanted
-    if(config.exportToCSV){
-        exportToCsv(config.csvToExport,translations);
+    // Write the outputs of all files in parallel.
+    QList<const TsFileJob *> outputs;
+    for (const LanguageJob &job : jobs) {
+        for (const TsFileJob &file : job.files)
+            outputs.append(&file);
+    }
+    const bool written = writeOutputs(config, outputs);
+
+    // Report what the run did and where its time went.
+    int translatedMessages = 0;
+    for (const LanguageJob &job : jobs) {
+        for (const TsFileJob &file : job.files) {
+            for (const MessageInfo &msg : file.catalog.messages())
+                translatedMessages += msg.isModified() ? 1 : 0;
+        }
     }
+    metrics().setMessagesTranslated(translatedMessages);
+    if (!config.metricsReportPath.isEmpty() && metrics().writeReport(config.metricsReportPath))
+        qDebug() << "Metrics report written to" << config.metricsReportPath;
+
+    if (!written)
+        return 1;
 
-    return 0;
+    // Everything the journal protected is stored in the outputs now.
+    if (!config.importFromCSV && !config.checkpointPath.isEmpty())
+        journal.remove();
+
+    if (!watch)
+        return 0;
+
+    // Watch mode: whenever lupdate has rewritten TS files, translate only what is new in them
+    // over the connections and translation memory of this run, then write them back.
+    TsFileWatcher watcher(tsFiles, [&](const QStringList &changed) {
+        QList<Catalog> updated;
+        QList<const TsFileJob *> changedOutputs;
+        for (const QString &path : changed) {
+            const int f = int(tsFiles.indexOf(path));
+            const Catalog catalog = parseFile(path);
+            if (catalog.messageCount() == 0) {
+                qWarning() << "Keeping the previous state of" << path << "as no messages could be read.";
+                continue;
+            }
+            for (LanguageJob &job : jobs) {
+                TsFileJob &file = job.files[f];
+                Catalog next = catalog;
+                carryOverTranslations(next, file.catalog);
+                file.catalog = next;
+                updated.append(next);
+                changedOutputs.append(&file);
+            }
+        }
+
+        const QList<QStringList> sourceGroups = collectSourcesByContext(updated, config.contextPriority);
+        if (sourceGroups.isEmpty()) {
+            qDebug() << "No new phrases in" << changed;
+        } else {
+            const QList<QList<QStringList>> batchesPerJob =
+                buildBatches(config, jobs, sourceGroups, useMemory ? &memory : nullptr, models);
+            sendBatches(config, backendOrder, jobs, batchesPerJob, useMemory ? &memory : nullptr, nullptr);
+        }
+
+        // Files whose outputs already hold every translation are left alone, which also ends
+        // the round trip of a TS file that is written back to itself.
+        QList<const TsFileJob *> modified;
+        for (const TsFileJob *file : std::as_const(changedOutputs)) {
+            const QList<MessageInfo> &messages = file->catalog.messages();
+            if (std::any_of(messages.begin(), messages.end(), [](const MessageInfo &msg) { return msg.isModified(); }))
+                modified.append(file);
+        }
+        if (!modified.isEmpty() && writeOutputs(config, modified))
+            qDebug() << "Updated" << modified.size() << "outputs after changes to" << changed;
+    });
+    qDebug() << "Watching" << tsFiles.size() << "TS files for changes.";
+    return app.exec();
 }
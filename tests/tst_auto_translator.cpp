@@ -0,0 +1,886 @@
+#include <QDateTime>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QNetworkReply>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include "auto_translator.h"
+#include "mock_translation_server.h"
+#include "synthetic_ts.h"
+
+/// A TS file in the format lupdate writes, with markup, entities, line breaks and non-ASCII text.
+static const char kSampleTs[] = R"(<?xml version="1.0" encoding="utf-8"?>
+<!DOCTYPE TS>
+<TS version="2.1" language="de_DE">
+<context>
+    <name>MainWindow</name>
+    <message>
+        <location filename="../src/mainwindow.cpp" line="12"/>
+        <location filename="../src/mainwindow.ui" line="40"/>
+        <source>&amp;Open &quot;file&quot;</source>
+        <translation type="unfinished"></translation>
+    </message>
+    <message>
+        <location filename="../src/mainwindow.cpp" line="20"/>
+        <source>Line one
+Line two &lt;b&gt;</source>
+        <translation>Zeile eins
+Zeile zwei &lt;b&gt;</translation>
+    </message>
+    <message>
+        <location filename="../src/mainwindow.cpp" line="31"/>
+        <source>Save, "quick" and close</source>
+        <translation type="unfinished"></translation>
+    </message>
+</context>
+<context>
+    <name>Dialog</name>
+    <message>
+        <location filename="../src/dialog.cpp" line="7"/>
+        <source>Größe: %1</source>
+        <translation type="unfinished"></translation>
+    </message>
+</context>
+</TS>
+)";
+
+/// A TS file with every translation type, and a source shared by two contexts.
+static const char kTypesTs[] = R"(<?xml version="1.0" encoding="utf-8"?>
+<!DOCTYPE TS>
+<TS version="2.1" language="de_DE">
+<context>
+    <name>Dialog</name>
+    <message>
+        <source>Cancel</source>
+        <translation type="unfinished"></translation>
+    </message>
+    <message>
+        <source>Apply</source>
+        <translation>Anwenden</translation>
+    </message>
+    <message>
+        <source>Stale</source>
+        <translation type="unfinished">Alt</translation>
+    </message>
+</context>
+<context>
+    <name>MainWindow</name>
+    <message>
+        <source>Cancel</source>
+        <translation></translation>
+    </message>
+    <message>
+        <source>Old</source>
+        <translation type="obsolete">Früher</translation>
+    </message>
+    <message>
+        <source>Gone</source>
+        <translation type="vanished">Weg</translation>
+    </message>
+    <message>
+        <source>Open</source>
+        <translation type="unfinished"></translation>
+    </message>
+</context>
+<context>
+    <name>Settings</name>
+    <message>
+        <source>Theme</source>
+        <translation type="unfinished"></translation>
+    </message>
+</context>
+</TS>
+)";
+
+/// Size from which parseTsFile() parses in chunks in TsReadMode::Parallel, see kParallelTsBytes.
+static const qint64 kParallelTsBytes = 4 * 1024 * 1024;
+
+/// @brief One line per message with its context, source, translation, type, locations and ordinal.
+/// @param withOriginals If true the parsed translation and type are listed too.
+static QStringList dump(const Catalog &catalog, bool withOriginals = false)
+{
+    QStringList lines;
+    for (const MessageInfo &msg : catalog.messages()) {
+        QStringList locations;
+        for (const Location &loc : catalog.locations(msg))
+            locations.append(loc.filename() + QLatin1Char(':') + QString::number(loc.line));
+        QStringList fields{catalog.contextName(msg), msg.source, msg.translation, msg.translationType,
+                           locations.join(QLatin1Char(';')), QString::number(msg.ordinal)};
+        if (withOriginals)
+            fields << msg.originalTranslation << msg.originalType;
+        lines.append(fields.join(QLatin1Char('|')));
+    }
+    return lines;
+}
+
+static bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+static QByteArray readFile(const QString &path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+/// @brief A German job over one parsed TS file, with its unfinished messages pending.
+static LanguageJob pendingJob(const QString &tsPath)
+{
+    LanguageJob job;
+    job.target.lang = QStringLiteral("German");
+    job.target.langPostfix = QStringLiteral("DE_de");
+    job.files.append(TsFileJob());
+    Catalog &catalog = job.files.last().catalog;
+    catalog = parseTsFile(tsPath, TsReadMode::Stream);
+    catalog.buildSourceIndex();
+    selectMessages(catalog, {QStringLiteral("unfinished")});
+    return job;
+}
+
+/// @brief A backend of the mock server answering one request at a time.
+static BackendConfig mockBackend(const MockTranslationServer &server, const QString &name = QStringLiteral("mock"))
+{
+    BackendConfig backend{};
+    backend.name = name;
+    backend.endpoint = server.endpoint().toString();
+    backend.model = name;
+    backend.maxConcurrentRequests = 1;
+    return backend;
+}
+
+/// @brief A finished reply that only carries the headers a test gives it.
+class HeaderReply : public QNetworkReply
+{
+public:
+    explicit HeaderReply(const QList<QPair<QByteArray, QByteArray>> &headers)
+    {
+        for (const auto &header : headers)
+            setRawHeader(header.first, header.second);
+    }
+
+    void abort() override {}
+
+protected:
+    qint64 readData(char *, qint64) override { return -1; }
+};
+
+class TestAutoTranslator : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(m_dir.isValid());
+        m_samplePath = m_dir.filePath("sample.ts");
+        QVERIFY(writeFile(m_samplePath, kSampleTs));
+        m_typesPath = m_dir.filePath("types.ts");
+        QVERIFY(writeFile(m_typesPath, kTypesTs));
+    }
+
+    void tsParsersAgree_data()
+    {
+        QTest::addColumn<bool>("large");
+        QTest::newRow("sample") << false;
+        QTest::newRow("synthetic, above the parallel threshold") << true;
+    }
+
+    void tsParsersAgree()
+    {
+        QFETCH(bool, large);
+        QString path = m_samplePath;
+        if (large) {
+            SyntheticTsOptions options;
+            options.contexts = 300;
+            options.messagesPerContext = 100;
+            options.translatedRate = 0.2;
+            path = m_dir.filePath("large.ts");
+            QVERIFY(writeSyntheticTs(path, options));
+            QVERIFY(QFileInfo(path).size() >= kParallelTsBytes);
+        }
+
+        const QStringList streamed = dump(parseTsFile(path, TsReadMode::Stream), true);
+        QVERIFY(!streamed.isEmpty());
+        QCOMPARE(dump(parseTsFile(path, TsReadMode::Mapped), true), streamed);
+        QCOMPARE(dump(parseTsFile(path, TsReadMode::Parallel), true), streamed);
+    }
+
+    void tsSampleContents()
+    {
+        const Catalog catalog = parseTsFile(m_samplePath, TsReadMode::Stream);
+        QCOMPARE(catalog.contexts().size(), 2);
+        QCOMPARE(catalog.messageCount(), 4);
+        QCOMPARE(catalog.message(0).source, QStringLiteral("&Open \"file\""));
+        QCOMPARE(catalog.message(0).translationType, QStringLiteral("unfinished"));
+        QCOMPARE(catalog.message(1).translation, QStringLiteral("Zeile eins\nZeile zwei <b>"));
+        QCOMPARE(catalog.message(3).source, QStringLiteral("Größe: %1"));
+        QCOMPARE(catalog.contextName(catalog.message(3)), QStringLiteral("Dialog"));
+        QCOMPARE(catalog.locations(catalog.message(0)).size(), 2);
+    }
+
+    void tsFullWriteRoundTrip()
+    {
+        Catalog catalog = parseTsFile(m_samplePath, TsReadMode::Stream);
+        catalog.message(0).translation = QStringLiteral("&Öffne \"Datei\" <i>&amp;</i>");
+        const QString path = m_dir.filePath("full.ts");
+        QVERIFY(writeTsFile(path, catalog));
+
+        catalog.message(0).translationType.clear(); // The writer only marks empty translations.
+        QCOMPARE(dump(parseTsFile(path, TsReadMode::Stream)), dump(catalog));
+    }
+
+    void tsIncrementalWrite()
+    {
+        Catalog catalog = parseTsFile(m_samplePath, TsReadMode::Mapped);
+        const QString path = m_dir.filePath("incremental.ts");
+
+        // Nothing changed: the output is the input, byte for byte.
+        QVERIFY(writeTsFileIncremental(m_samplePath, path, catalog));
+        QCOMPARE(readFile(path), QByteArray(kSampleTs));
+
+        // Changed translations read back like the ones the full writer writes.
+        catalog.message(0).translation = QStringLiteral("&Öffne \"Datei\" <i>&amp;</i>");
+        catalog.message(1).translation.clear();
+        catalog.message(3).translation = QStringLiteral("Größe: %1\nzweite Zeile");
+        QVERIFY(writeTsFileIncremental(m_samplePath, path, catalog));
+        const QString fullPath = m_dir.filePath("incremental_full.ts");
+        QVERIFY(writeTsFile(fullPath, catalog));
+        QCOMPARE(dump(parseTsFile(path, TsReadMode::Stream)), dump(parseTsFile(fullPath, TsReadMode::Stream)));
+
+        // Unchanged messages keep their original bytes.
+        QVERIFY(readFile(path).contains("<source>Save, \"quick\" and close</source>\n"
+                                        "        <translation type=\"unfinished\"></translation>"));
+    }
+
+    void tsIncrementalWriteFallsBack_data()
+    {
+        QTest::addColumn<QString>("change");
+        QTest::newRow("messages added") << QStringLiteral("grown");
+        QTest::newRow("source changed, same stamp") << QStringLiteral("source");
+        QTest::newRow("locations replaced") << QStringLiteral("locations");
+    }
+
+    /// Whenever the original file can not be spliced safely, the full writer's output is written.
+    void tsIncrementalWriteFallsBack()
+    {
+        QFETCH(QString, change);
+        const QString sourcePath = m_dir.filePath(change + QStringLiteral(".ts"));
+        QVERIFY(writeFile(sourcePath, kSampleTs));
+        Catalog catalog = parseTsFile(sourcePath, TsReadMode::Stream);
+        QCOMPARE(catalog.sourceStamp(), FileStamp::of(sourcePath));
+        catalog.message(2).translation = QStringLiteral("Speichern");
+
+        QByteArray edited(kSampleTs);
+        if (change == QLatin1String("grown")) {
+            // As if lupdate added a message in front of the changed one while translating.
+            edited.replace("    <message>\n        <location filename=\"../src/mainwindow.cpp\" line=\"31\"/>",
+                           "    <message>\n        <source>New</source>\n"
+                           "        <translation type=\"unfinished\"></translation>\n    </message>\n"
+                           "    <message>\n        <location filename=\"../src/mainwindow.cpp\" line=\"31\"/>");
+            QVERIFY(edited.size() > qsizetype(sizeof(kSampleTs)));
+            QVERIFY(writeFile(sourcePath, edited));
+        } else if (change == QLatin1String("source")) {
+            edited.replace("<source>Save, ", "<source>Sive, ");
+            const QDateTime modified = QFileInfo(sourcePath).lastModified();
+            QVERIFY(writeFile(sourcePath, edited));
+            QFile file(sourcePath);
+            QVERIFY(file.open(QIODevice::ReadWrite) && file.setFileTime(modified, QFileDevice::FileModificationTime));
+            file.close();
+            QCOMPARE(FileStamp::of(sourcePath), catalog.sourceStamp());
+        } else {
+            catalog.setLocations(0, {{locationFileNames().intern(u"../src/moved.cpp"), 3}});
+            QVERIFY(catalog.message(0).locationsModified);
+        }
+
+        const QString path = m_dir.filePath(change + QStringLiteral("_out.ts"));
+        QVERIFY(writeTsFileIncremental(sourcePath, path, catalog));
+        const QString fullPath = m_dir.filePath(change + QStringLiteral("_full.ts"));
+        QVERIFY(writeTsFile(fullPath, catalog));
+        QCOMPARE(readFile(path), readFile(fullPath));
+    }
+
+    void csvRoundTrip()
+    {
+        Catalog catalog = parseTsFile(m_samplePath, TsReadMode::Stream);
+        catalog.buildSourceIndex();
+        catalog.message(0).translation = QStringLiteral("&Öffne \"Datei\"");
+        catalog.message(1).translation = QStringLiteral("Zeile eins,\nZeile \"\"zwei\"\"");
+        catalog.message(2).translation = QStringLiteral("Speichern, \"schnell\" und\nschließen");
+        catalog.message(3).translation = QStringLiteral("Größe: %1 😀");
+        for (MessageInfo &msg : catalog.messages())
+            msg.translationType.clear();
+        const QString path = m_dir.filePath("roundtrip.csv");
+        QVERIFY(exportToCsv(path, catalog));
+
+        Catalog imported = parseTsFile(m_samplePath, TsReadMode::Stream);
+        imported.buildSourceIndex();
+        QVERIFY(importFromCsv(path, imported));
+        QCOMPARE(dump(imported), dump(catalog));
+    }
+
+    void csvChangedOnly()
+    {
+        Catalog catalog = parseTsFile(m_samplePath, TsReadMode::Stream);
+        catalog.message(2).translation = QStringLiteral("Speichern");
+        const QString path = m_dir.filePath("changed.csv");
+        QVERIFY(exportToCsv(path, catalog, true));
+        QCOMPARE(readFile(path), QByteArray("source,translation,translationType,locations,context\n"
+                                            "\"Save, \"\"quick\"\" and close\",Speichern,unfinished,"
+                                            "../src/mainwindow.cpp:31,MainWindow\n"));
+    }
+
+    void csvChunkedRead_data()
+    {
+        QTest::addColumn<QByteArray>("csv");
+        QTest::addColumn<int>("records");
+        QTest::newRow("stray quotes") << QByteArray("source,translation\n"
+                                                    "5\" screen,5\" Bildschirm\n"
+                                                    "a \"b\" c,\"x\ny\"\n"
+                                                    "\"He said \"\"hi\"\"\",Er sagte \"hallo\n"
+                                                    "1\",\"2\n3\"\n"
+                                                    "last\",\"open\"x,\n")
+                                      << 6;
+        QTest::newRow("CRLF and BOM") << QByteArray("\xEF\xBB\xBFsource,translation\r\n"
+                                                    "\"a\r\nb\",c\"\r\n"
+                                                    "d,\"e,\"\"f\"\"\"\r\n"
+                                                    "\"g\"\"\",\"h\"\r\n"
+                                                    "i\",j")
+                                      << 5;
+        QTest::newRow("unterminated quote") << QByteArray("a,b\nc,\"d\ne,f\ng,h\n") << 2;
+    }
+
+    void csvChunkedRead()
+    {
+        QFETCH(QByteArray, csv);
+        QFETCH(int, records);
+        const QList<QStringList> sequential = readCsvRecords(csv.constData(), csv.size(), 1);
+        QCOMPARE(sequential.size(), records);
+        for (int chunkCount : {2, 3, 4, 7, int(csv.size())})
+            QCOMPARE(readCsvRecords(csv.constData(), csv.size(), chunkCount), sequential);
+    }
+
+    void flatJsonObject_data()
+    {
+        QTest::addColumn<QByteArray>("json");
+        QTest::addColumn<QString>("key");
+        QTest::addColumn<QString>("value");
+        QTest::newRow("plain") << QByteArray(R"({"source": "Open", "translation": "Öffnen"})")
+                               << QStringLiteral("translation") << QStringLiteral("Öffnen");
+        QTest::newRow("escapes") << QByteArray(R"({"t": "a \"q\" \\ \/ \b\f\n\r\t end"})") << QStringLiteral("t")
+                                 << QStringLiteral("a \"q\" \\ / \b\f\n\r\t end");
+        QTest::newRow("unicode escape") << QByteArray(R"({"t": "Gr\u00f6\u00dfe"})") << QStringLiteral("t")
+                                        << QStringLiteral("Größe");
+        QTest::newRow("surrogate pair") << QByteArray(R"({"t": "smile \ud83d\ude00"})") << QStringLiteral("t")
+                                        << QStringLiteral("smile 😀");
+        QTest::newRow("raw UTF-8") << QByteArray("{\"t\": \"smile \xF0\x9F\x98\x80\"}") << QStringLiteral("t")
+                                   << QStringLiteral("smile 😀");
+        QTest::newRow("number") << QByteArray(R"({"id": 12, "t": "x"})") << QStringLiteral("id")
+                                << QStringLiteral("12");
+        QTest::newRow("missing key") << QByteArray(R"({"id": 12})") << QStringLiteral("t") << QString();
+    }
+
+    void flatJsonObject()
+    {
+        QFETCH(QByteArray, json);
+        QFETCH(QString, key);
+        QFETCH(QString, value);
+        FlatJsonObject object;
+        QVERIFY(object.parse(json.constData(), json.size()));
+        const QByteArray latin1 = key.toLatin1();
+        QCOMPARE(object.value(QLatin1String(latin1)), value);
+        QCOMPARE(object.value(QLatin1String(latin1)).isNull(), value.isNull());
+    }
+
+    void flatJsonObjectRejects_data()
+    {
+        QTest::addColumn<QByteArray>("json");
+        QTest::newRow("unterminated string") << QByteArray(R"({"t": "abc})");
+        QTest::newRow("bad escape") << QByteArray(R"({"t": "\x"})");
+        QTest::newRow("short unicode escape") << QByteArray(R"({"t": "\u00"})");
+        QTest::newRow("nested object") << QByteArray(R"({"t": {"a": 1}})");
+        QTest::newRow("missing colon") << QByteArray(R"({"t" "a"})");
+        QTest::newRow("cut off") << QByteArray(R"({"t": "a",)");
+    }
+
+    void flatJsonObjectRejects()
+    {
+        QFETCH(QByteArray, json);
+        FlatJsonObject object;
+        QVERIFY(!object.parse(json.constData(), json.size()));
+    }
+
+    void jsonEscaping()
+    {
+        const QString text = QStringLiteral("\"q\" \\ / \n\r\t\b\f \x01 Größe 😀 ") + QChar(0xD800)
+                             + QStringLiteral("!");
+        QByteArray json("[\"");
+        appendJsonEscaped(json, text);
+        json += "\"]";
+        QJsonParseError error;
+        const QJsonDocument document = QJsonDocument::fromJson(json, &error);
+        QCOMPARE(error.error, QJsonParseError::NoError);
+        // A lone surrogate can not be encoded and becomes U+FFFD.
+        QString expected = text;
+        expected.replace(QChar(0xD800), QChar(0xFFFD));
+        QCOMPARE(document.array().at(0).toString(), expected);
+    }
+
+    void snapshotRoundTrip()
+    {
+        const QString tsPath = m_dir.filePath("snapshot.ts");
+        QVERIFY(writeFile(tsPath, kSampleTs));
+        Catalog catalog = parseTsFile(tsPath, TsReadMode::Stream);
+        catalog.message(0).translation = QStringLiteral("&Öffne \"Datei\"");
+        catalog.message(0).translationType.clear();
+        catalog.setLocations(2, {{locationFileNames().intern(u"../src/other.cpp"), 5}});
+        const QString snapshotPath = m_dir.filePath("snapshot.qats");
+        QVERIFY(writeCatalogSnapshot(snapshotPath, catalog, tsPath));
+
+        Catalog restored;
+        QVERIFY(readCatalogSnapshot(snapshotPath, restored, tsPath));
+        QCOMPARE(dump(restored, true), dump(catalog, true));
+        QCOMPARE(restored.contexts().size(), catalog.contexts().size());
+        QVERIFY(restored.message(2).locationsModified);
+        QVERIFY(!restored.message(0).locationsModified);
+        QCOMPARE(restored.sourceStamp(), FileStamp::of(tsPath));
+        QVERIFY(restored.message(0).isModified());
+        QVERIFY(!restored.message(1).isModified());
+
+        // A snapshot of another version of the TS file is not used.
+        QVERIFY(writeFile(tsPath, QByteArray(kSampleTs) + "\n"));
+        Catalog stale;
+        QVERIFY(!readCatalogSnapshot(snapshotPath, stale, tsPath));
+
+        // Neither is a damaged one.
+        const QByteArray snapshot = readFile(snapshotPath);
+        QVERIFY(writeFile(snapshotPath, snapshot.left(snapshot.size() / 2)));
+        QVERIFY(!readCatalogSnapshot(snapshotPath, stale));
+    }
+
+    void selectByType_data()
+    {
+        QTest::addColumn<QStringList>("types");
+        QTest::addColumn<QStringList>("expected");
+        QTest::newRow("unfinished") << QStringList{QStringLiteral("unfinished")}
+                                    << QStringList{QStringLiteral("Cancel"), QStringLiteral("Stale"),
+                                                   QStringLiteral("Cancel"), QStringLiteral("Open"),
+                                                   QStringLiteral("Theme")};
+        QTest::newRow("obsolete too") << QStringList{QStringLiteral("unfinished"), QStringLiteral("obsolete")}
+                                      << QStringList{QStringLiteral("Cancel"), QStringLiteral("Stale"),
+                                                     QStringLiteral("Cancel"), QStringLiteral("Old"),
+                                                     QStringLiteral("Open"), QStringLiteral("Theme")};
+        // Messages with neither a translation nor a type are always new.
+        QTest::newRow("none") << QStringList() << QStringList{QStringLiteral("Cancel")};
+    }
+
+    void selectByType()
+    {
+        QFETCH(QStringList, types);
+        QFETCH(QStringList, expected);
+        Catalog catalog = parseTsFile(m_typesPath);
+        QCOMPARE(selectMessages(catalog, types), int(expected.size()));
+        QStringList pending;
+        for (const MessageInfo &msg : catalog.messages()) {
+            if (msg.pending)
+                pending.append(msg.source);
+        }
+        QCOMPARE(pending, expected);
+    }
+
+    void sourcesByContext_data()
+    {
+        QTest::addColumn<QStringList>("priority");
+        QTest::addColumn<QList<QStringList>>("expected");
+        const QString open = QStringLiteral("&Open \"file\"");
+        const QString save = QStringLiteral("Save, \"quick\" and close");
+        const QString size = QStringLiteral("Größe: %1");
+        // The Dialog and MainWindow contexts of both files form one group each, in document order.
+        QTest::newRow("document order")
+            << QStringList()
+            << QList<QStringList>{{QStringLiteral("Cancel"), QStringLiteral("Stale"), size},
+                                  {QStringLiteral("Open"), open, save},
+                                  {QStringLiteral("Theme")}};
+        // A shared source goes with the first group it appears in.
+        QTest::newRow("priority")
+            << QStringList{QStringLiteral("Main*"), QStringLiteral("Set*")}
+            << QList<QStringList>{{QStringLiteral("Cancel"), QStringLiteral("Open"), open, save},
+                                  {QStringLiteral("Theme")},
+                                  {QStringLiteral("Stale"), size}};
+    }
+
+    void sourcesByContext()
+    {
+        QFETCH(QStringList, priority);
+        QFETCH(QList<QStringList>, expected);
+        QList<Catalog> catalogs{parseTsFile(m_typesPath), parseTsFile(m_samplePath)};
+        for (Catalog &catalog : catalogs)
+            selectMessages(catalog, {QStringLiteral("unfinished")});
+        QCOMPARE(collectSourcesByContext(catalogs, priority), expected);
+    }
+
+    void groupedBatches_data()
+    {
+        QTest::addColumn<QList<QStringList>>("groups");
+        QTest::addColumn<int>("maxTokens");
+        QTest::addColumn<int>("maxPhrases");
+        QTest::addColumn<QList<QStringList>>("expected");
+        const QString a = QStringLiteral("a"), b = QStringLiteral("b"), c = QStringLiteral("c");
+        const QString d = QStringLiteral("d"), e = QStringLiteral("e"), f = QStringLiteral("f");
+        QTest::newRow("groups kept whole") << QList<QStringList>{{a, b}, {c, d, e}, {f}} << 0 << 4
+                                           << QList<QStringList>{{a, b}, {c, d, e, f}};
+        QTest::newRow("large group split") << QList<QStringList>{{a}, {b, c, d, e, f}} << 0 << 3
+                                           << QList<QStringList>{{a}, {b, c, d}, {e, f}};
+        QTest::newRow("token budget") << QList<QStringList>{{a, b}, {c}} << estimateBatchTokens({a, b}) << 10
+                                      << QList<QStringList>{{a, b}, {c}};
+    }
+
+    void groupedBatches()
+    {
+        QFETCH(QList<QStringList>, groups);
+        QFETCH(int, maxTokens);
+        QFETCH(int, maxPhrases);
+        QFETCH(QList<QStringList>, expected);
+        QCOMPARE(packGroupedBatches(groups, maxTokens, maxPhrases), expected);
+    }
+
+    void carryOver()
+    {
+        Catalog previous = parseTsFile(m_typesPath);
+        previous.buildSourceIndex();
+        selectMessages(previous, {QStringLiteral("unfinished")});
+        QVERIFY(applyTranslation(previous, QStringLiteral("Cancel"), QStringLiteral("Abbrechen")));
+        QVERIFY(applyTranslation(previous, QStringLiteral("Open"), QStringLiteral("Öffnen")));
+
+        // lupdate renamed Theme to a source another context has already translated.
+        const QString updatedPath = m_dir.filePath("types_updated.ts");
+        const QByteArray updatedTs = QByteArray(kTypesTs).replace("<source>Theme</source>", "<source>Open</source>");
+        QVERIFY(writeFile(updatedPath, updatedTs));
+        Catalog updated = parseTsFile(updatedPath);
+        QCOMPARE(selectMessages(updated, {QStringLiteral("unfinished")}), 5);
+
+        // Only the still untranslated Stale and the Open of the Settings context are left.
+        QCOMPARE(carryOverTranslations(updated, previous), 2);
+        QStringList pending;
+        for (const MessageInfo &msg : updated.messages()) {
+            if (msg.pending)
+                pending.append(updated.contextName(msg) + QLatin1Char('/') + msg.source);
+        }
+        QCOMPARE(pending, (QStringList{QStringLiteral("Dialog/Stale"), QStringLiteral("Settings/Open")}));
+        QCOMPARE(updated.message(0).translation, QStringLiteral("Abbrechen"));
+        QCOMPARE(updated.message(1).translation, QStringLiteral("Anwenden"));
+        QCOMPARE(updated.message(3).translation, QStringLiteral("Abbrechen"));
+        QCOMPARE(updated.message(6).translation, QStringLiteral("Öffnen"));
+        QVERIFY(updated.message(7).translation.isEmpty());
+    }
+
+    void adaptiveResizing()
+    {
+        Config config{};
+        config.adaptiveBatching = true;
+        config.apiCallSize = 10;
+        config.adaptiveMaxBatchSize = 20;
+        BackendConfig backendConfig{};
+        backendConfig.name = QStringLiteral("idle");
+        backendConfig.maxConcurrentRequests = 4;
+        ChatCompletionsBackend backend(backendConfig, QString());
+        BatchScheduler scheduler(config, {&backend});
+        BatchScheduler::BackendState &state = scheduler.m_backends.first();
+        LanguageJob job;
+        auto batchOf = [&job](int size) {
+            QStringList phrases;
+            for (int i = 0; i < size; ++i)
+                phrases.append(QStringLiteral("p%1").arg(i));
+            return BatchScheduler::PendingBatch{phrases, &job, 0, 0, 0, 0};
+        };
+
+        // A full reply that keeps up grows the batches, and a window of them the concurrency.
+        state.concurrency = 1;
+        scheduler.adapt(state, batchOf(10), 10, false, 200, 1000);
+        QCOMPARE(state.batchSize, 15);
+        QCOMPARE(state.concurrency, 2);
+        // Growth stops at the adaptive maximum.
+        state.batchSize = 18;
+        scheduler.adapt(state, batchOf(18), 18, false, 200, 1000);
+        QCOMPARE(state.batchSize, 20);
+        // And when larger requests translate fewer phrases per second.
+        state.batchSize = 10;
+        state.phrasesPerSecond = 1000;
+        scheduler.adapt(state, batchOf(10), 10, false, 200, 1000);
+        QCOMPARE(state.batchSize, 10);
+
+        // Rate limiting halves the concurrency, an incomplete answer the batch size.
+        scheduler.adapt(state, batchOf(10), 0, true, 429, 1000);
+        QCOMPARE(state.concurrency, 1);
+        QCOMPARE(state.batchSize, 10);
+        scheduler.adapt(state, batchOf(10), 8, false, 200, 1000);
+        QCOMPARE(state.batchSize, 5);
+        scheduler.adapt(state, batchOf(5), 0, true, 400, 1000);
+        QCOMPARE(state.batchSize, 5);
+        // A configured size below the adaptive minimum is not exceeded when shrinking.
+        config.apiCallSize = 2;
+        state.batchSize = 2;
+        scheduler.adapt(state, batchOf(2), 0, true, 400, 1000);
+        QCOMPARE(state.batchSize, 2);
+    }
+
+    void adaptiveHeadResizing()
+    {
+        Config config{};
+        config.adaptiveBatching = true;
+        BackendConfig backendConfig{};
+        backendConfig.name = QStringLiteral("idle");
+        ChatCompletionsBackend backend(backendConfig, QString());
+        BatchScheduler scheduler(config, {&backend});
+        BatchScheduler::BackendState &state = scheduler.m_backends.first();
+        LanguageJob job;
+        LanguageJob otherJob;
+        auto queue = [&](const QList<QPair<QStringList, int>> &batches, LanguageJob *other = nullptr) {
+            state.pending.clear();
+            for (const auto &batch : batches)
+                state.pending.enqueue({batch.first, batch.second < 0 ? other : &job, 0, 0, 0, qAbs(batch.second)});
+            scheduler.resizeHead(state);
+            QList<QStringList> queued;
+            for (const BatchScheduler::PendingBatch &batch : std::as_const(state.pending))
+                queued.append(batch.phrases);
+            return queued;
+        };
+        const QString a = QStringLiteral("a"), b = QStringLiteral("b"), c = QStringLiteral("c");
+        const QString d = QStringLiteral("d"), e = QStringLiteral("e");
+
+        // A head larger than the batch size leaves its tail at the front of the queue.
+        state.batchSize = 3;
+        QCOMPARE(queue({{{a, b, c, d, e}, 0}, {{a}, 1}}), (QList<QStringList>{{a, b, c}, {d, e}, {a}}));
+        // Pieces of the head's own batch are taken in part.
+        state.batchSize = 4;
+        QCOMPARE(queue({{{a, b}, 0}, {{c, d, e}, 0}}), (QList<QStringList>{{a, b, c, d}, {e}}));
+        // Other batches are taken whole, up to the first one that does not fit.
+        QCOMPARE(queue({{{a}, 0}, {{b, c}, 1}, {{d, e}, 2}}), (QList<QStringList>{{a, b, c}, {d, e}}));
+        // Batches of another language are skipped.
+        QCOMPARE(queue({{{a}, 0}, {{b}, -1}, {{c}, 2}}, &otherJob), (QList<QStringList>{{a, c}, {b}}));
+        // Filling stays within the token budget of a request.
+        config.maxTokensPerRequest = estimateBatchTokens({a, b});
+        QCOMPARE(queue({{{a}, 0}, {{b}, 1}, {{c}, 2}}), (QList<QStringList>{{a, b}, {c}}));
+    }
+
+    void readOnlyLogsAreLeftUntouched()
+    {
+        // The last line lacks its newline, which an appending open would restore.
+        const QString memoryPath = m_dir.filePath("memory.jsonl");
+        const QByteArray log = R"({"s":"Open","l":"German","m":"mock","t":"Öffnen"})";
+        QVERIFY(writeFile(memoryPath, log));
+        const QString lang = QStringLiteral("German");
+        const QString model = QStringLiteral("mock");
+        TranslationMemory memory;
+        QVERIFY(memory.open(memoryPath, true));
+        QString translation;
+        QVERIFY(memory.lookup(QStringLiteral("Open"), lang, {model}, &translation));
+        QCOMPARE(translation, QStringLiteral("Öffnen"));
+        memory.store(QStringLiteral("Close"), lang, model, QStringLiteral("Schließen"));
+        QCOMPARE(readFile(memoryPath), log);
+
+        const QString journalPath = m_dir.filePath("journal.jsonl");
+        CheckpointJournal journal;
+        QVERIFY(!journal.open(journalPath, true));
+        QVERIFY(!QFileInfo::exists(journalPath));
+    }
+
+    void resetDuration_data()
+    {
+        QTest::addColumn<QByteArray>("value");
+        QTest::addColumn<qint64>("expected");
+        QTest::newRow("seconds") << QByteArray("1s") << qint64(1000);
+        QTest::newRow("minutes and seconds") << QByteArray("6m0s") << qint64(360000);
+        QTest::newRow("fraction") << QByteArray("1.5s") << qint64(1500);
+        QTest::newRow("milliseconds") << QByteArray("20ms") << qint64(20);
+        QTest::newRow("hours") << QByteArray("1h") << qint64(3600000);
+        QTest::newRow("no unit") << QByteArray("2") << qint64(2000);
+        QTest::newRow("empty") << QByteArray() << qint64(-1);
+        QTest::newRow("unknown unit") << QByteArray("5d") << qint64(-1);
+        QTest::newRow("no number") << QByteArray("soon") << qint64(-1);
+    }
+
+    void resetDuration()
+    {
+        QFETCH(QByteArray, value);
+        QFETCH(qint64, expected);
+        QCOMPARE(parseResetDuration(value), expected);
+    }
+
+    void retryAfter_data()
+    {
+        QTest::addColumn<QByteArray>("header");
+        QTest::addColumn<QByteArray>("value");
+        QTest::addColumn<qint64>("expected");
+        QTest::newRow("milliseconds") << QByteArray("retry-after-ms") << QByteArray("250") << qint64(250);
+        QTest::newRow("seconds") << QByteArray("Retry-After") << QByteArray("3") << qint64(3000);
+        QTest::newRow("none") << QByteArray("x-request-id") << QByteArray("1") << qint64(-1);
+        QTest::newRow("invalid") << QByteArray("Retry-After") << QByteArray("later") << qint64(-1);
+    }
+
+    void retryAfter()
+    {
+        QFETCH(QByteArray, header);
+        QFETCH(QByteArray, value);
+        QFETCH(qint64, expected);
+        const HeaderReply reply({{header, value}});
+        QCOMPARE(retryAfterMs(&reply), expected);
+    }
+
+    void retryAfterDate()
+    {
+        const QByteArray at = QDateTime::currentDateTimeUtc().addSecs(30).toString(Qt::RFC2822Date).toLatin1();
+        const HeaderReply dated({{"Retry-After", at}});
+        const qint64 delay = retryAfterMs(&dated);
+        QVERIFY2(delay > 28000 && delay <= 30000, QByteArray::number(delay));
+
+        // retry-after-ms is the more precise of the two.
+        const HeaderReply both({{"Retry-After", "3"}, {"retry-after-ms", "40"}});
+        QCOMPARE(retryAfterMs(&both), qint64(40));
+    }
+
+    void rateLimiterBuckets()
+    {
+        RateLimiter requests(2, 0);
+        QCOMPARE(requests.delayFor(100000), qint64(0));
+        requests.consume(100000);
+        requests.consume(100000);
+        // The next request waits until half a minute has refilled one.
+        qint64 delay = requests.delayFor(0);
+        QVERIFY2(delay > 29000 && delay <= 30001, QByteArray::number(delay));
+
+        RateLimiter tokens(0, 600);
+        // A request larger than the whole bucket only waits for a full one.
+        QCOMPARE(tokens.delayFor(6000), qint64(0));
+        tokens.consume(600);
+        delay = tokens.delayFor(300);
+        QVERIFY2(delay > 29000 && delay <= 30001, QByteArray::number(delay));
+
+        RateLimiter paused(0, 0);
+        QCOMPARE(paused.delayFor(1000), qint64(0));
+        paused.pause(5000);
+        delay = paused.delayFor(0);
+        QVERIFY2(delay > 4900 && delay <= 5000, QByteArray::number(delay));
+    }
+
+    void rateLimiterFollowsHeaders()
+    {
+        // A limit the configuration left open is taken from the reply, and an exhausted
+        // bucket waits for the reported reset.
+        const HeaderReply exhausted({{"x-ratelimit-limit-requests", "100"},
+                                     {"x-ratelimit-remaining-requests", "0"},
+                                     {"x-ratelimit-reset-requests", "2s"}});
+        RateLimiter requests(0, 0);
+        requests.update(&exhausted);
+        qint64 delay = requests.delayFor(0);
+        QVERIFY2(delay > 1900 && delay <= 2000, QByteArray::number(delay));
+
+        // The remaining tokens the server reports cap the local bucket.
+        const HeaderReply low({{"x-ratelimit-limit-tokens", "1000"}, {"x-ratelimit-remaining-tokens", "100"}});
+        RateLimiter tokens(0, 1000);
+        tokens.update(&low);
+        QCOMPARE(tokens.delayFor(100), qint64(0));
+        delay = tokens.delayFor(400);
+        QVERIFY2(delay > 17000 && delay <= 18001, QByteArray::number(delay));
+    }
+
+    void failedRequestIsRetried()
+    {
+        MockServerOptions serverOptions;
+        serverOptions.latencyMs = 10;
+        serverOptions.failedRequests = 1;
+        MockTranslationServer server(serverOptions);
+        QVERIFY(server.listen());
+
+        Config config{};
+        config.apiCallSize = 10;
+        config.maxRetries = 2;
+        ChatCompletionsBackend backend(mockBackend(server), QString());
+
+        LanguageJob job = pendingJob(m_samplePath);
+        const Catalog &catalog = job.files.first().catalog;
+        BatchScheduler scheduler(config, {&backend});
+        scheduler.addBatch({catalog.message(0).source, catalog.message(3).source}, &job);
+        scheduler.run();
+
+        // The 503 is retried on the same backend after the backoff.
+        QCOMPARE(server.requests(), 2);
+        QCOMPARE(catalog.message(3).translation, QStringLiteral("[German] Größe: %1"));
+        QVERIFY(!catalog.message(0).pending);
+    }
+
+    void exhaustedRetriesFallBack()
+    {
+        MockServerOptions failingOptions;
+        failingOptions.latencyMs = 10;
+        failingOptions.failedRequests = 100;
+        MockTranslationServer failing(failingOptions);
+        QVERIFY(failing.listen());
+        MockServerOptions fallbackOptions;
+        fallbackOptions.latencyMs = 10;
+        MockTranslationServer fallback(fallbackOptions);
+        QVERIFY(fallback.listen());
+
+        Config config{};
+        config.apiCallSize = 10;
+        config.maxRetries = 0;
+        ChatCompletionsBackend primary(mockBackend(failing, QStringLiteral("primary")), QString());
+        ChatCompletionsBackend secondary(mockBackend(fallback, QStringLiteral("secondary")), QString());
+
+        LanguageJob job = pendingJob(m_samplePath);
+        const Catalog &catalog = job.files.first().catalog;
+        BatchScheduler scheduler(config, {&primary, &secondary});
+        scheduler.addBatch({catalog.message(0).source, catalog.message(3).source}, &job);
+        scheduler.run();
+        QCOMPARE(failing.requests(), 1);
+        QCOMPARE(fallback.requests(), 1);
+        QCOMPARE(catalog.message(3).translation, QStringLiteral("[German] Größe: %1"));
+
+        // Without a backend left the phrases are given up on and stay pending.
+        LanguageJob dropped = pendingJob(m_samplePath);
+        BatchScheduler lastResort(config, {&primary});
+        lastResort.addBatch({dropped.files.first().catalog.message(3).source}, &dropped);
+        lastResort.run();
+        QCOMPARE(failing.requests(), 2);
+        QVERIFY(dropped.files.first().catalog.message(3).pending);
+    }
+
+    void stalledRequestIsRetried()
+    {
+        MockServerOptions serverOptions;
+        serverOptions.latencyMs = 10;
+        serverOptions.stalledRequests = 1;
+        MockTranslationServer server(serverOptions);
+        QVERIFY(server.listen());
+
+        Config config{};
+        config.apiCallSize = 10;
+        config.maxRetries = 2;
+        BackendConfig backendConfig = mockBackend(server);
+        backendConfig.requestTimeoutMs = 300;
+        ChatCompletionsBackend backend(backendConfig, QString());
+
+        LanguageJob job = pendingJob(m_samplePath);
+        const Catalog &catalog = job.files.first().catalog;
+        BatchScheduler scheduler(config, {&backend});
+        scheduler.addBatch({catalog.message(0).source, catalog.message(3).source}, &job);
+        scheduler.run();
+
+        // The first request never gets an answer; it times out and is sent again.
+        QCOMPARE(server.requests(), 2);
+        QCOMPARE(catalog.message(0).translation, QStringLiteral("[German] &Open \"file\""));
+        QCOMPARE(catalog.message(3).translation, QStringLiteral("[German] Größe: %1"));
+        QVERIFY(!catalog.message(0).pending);
+    }
+
+private:
+    QTemporaryDir m_dir;
+    QString m_samplePath;
+    QString m_typesPath;
+};
+
+QTEST_GUILESS_MAIN(TestAutoTranslator)
+#include "tst_auto_translator.moc"